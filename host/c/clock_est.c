@@ -0,0 +1,120 @@
+#include <math.h>
+#include <string.h>
+#include "clock_est.h"
+
+// Samples whose round trip is within this factor of the
+// shortest one in the window are used for the fit
+#define RTT_FILTER  2
+
+static void fit(clock_est_t *est);
+
+void clock_est_init(clock_est_t *est) {
+    memset(est, 0, sizeof(*est));
+    est->nsPerUs = 1000.0;
+}
+
+// The device clock wraps every 2^32 us (about 71 minutes). Take the
+// unwrapped time closest to the most recent one we've seen.
+static int64_t unwrap(const clock_est_t *est, uint32_t deviceUs) {
+    if(est->count == 0) {
+        return deviceUs;
+    }
+    return est->lastDeviceUs + (int32_t)(deviceUs - (uint32_t)est->lastDeviceUs);
+}
+
+void clock_est_add(clock_est_t *est, uint32_t deviceUs, int64_t hostBeforeNs, int64_t hostAfterNs) {
+    clock_sample_t *sample = &est->samples[est->next];
+
+    sample->deviceUs = unwrap(est, deviceUs);
+    sample->hostNs = hostBeforeNs + ((hostAfterNs - hostBeforeNs) / 2);
+    sample->rttNs = hostAfterNs - hostBeforeNs;
+
+    est->lastDeviceUs = sample->deviceUs;
+    est->next = (est->next + 1) % CLOCK_EST_SAMPLES;
+    if(est->count < CLOCK_EST_SAMPLES) {
+        est->count++;
+    }
+
+    fit(est);
+}
+
+bool clock_est_toHost(const clock_est_t *est, uint32_t deviceUs, int64_t *hostNs) {
+    if(!est->valid) {
+        return false;
+    }
+
+    int64_t dt = unwrap(est, deviceUs) - est->refUs;
+    *hostNs = (int64_t)llround(est->refNs + (dt * est->nsPerUs));
+    return true;
+}
+
+double clock_est_driftPpm(const clock_est_t *est) {
+    // Positive when the device clock runs fast
+    return ((1000.0 / est->nsPerUs) - 1.0) * 1e6;
+}
+
+static void fit(clock_est_t *est) {
+    int64_t minRtt = INT64_MAX;
+    int n = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+    for(int i = 0; i < est->count; i++) {
+        if(est->samples[i].rttNs < minRtt) {
+            minRtt = est->samples[i].rttNs;
+        }
+    }
+
+    // Work relative to the newest sample to keep the doubles precise
+    int64_t refUs = est->lastDeviceUs;
+    int64_t refNs = est->samples[(est->next + CLOCK_EST_SAMPLES - 1) % CLOCK_EST_SAMPLES].hostNs;
+
+    for(int i = 0; i < est->count; i++) {
+        const clock_sample_t *s = &est->samples[i];
+        if(s->rttNs > (minRtt * RTT_FILTER)) {
+            continue;
+        }
+        double x = s->deviceUs - refUs;
+        double y = s->hostNs - refNs;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        n++;
+    }
+
+    double nsPerUs = 1000.0;
+    double den = (n * sxx) - (sx * sx);
+    // Drift needs at least two samples spread out in time. Until
+    // then assume the clocks run at the same rate.
+    if((n >= 2) && (den > 0)) {
+        nsPerUs = ((n * sxy) - (sx * sy)) / den;
+    }
+    double intercept = (sy - (nsPerUs * sx)) / n;
+
+    // The error is bounded by how far the samples sit from the line, plus
+    // the uncertainty of where in its transfer each sample was taken. Each
+    // device stamp can sit anywhere in its round trip, so that uncertainty
+    // is half the slowest round trip we kept, not the fastest.
+    double maxResidual = 0;
+    int64_t maxRtt = 0;
+    for(int i = 0; i < est->count; i++) {
+        const clock_sample_t *s = &est->samples[i];
+        if(s->rttNs > (minRtt * RTT_FILTER)) {
+            continue;
+        }
+        double residual = fabs((s->hostNs - refNs) - (intercept + (nsPerUs * (s->deviceUs - refUs))));
+        if(residual > maxResidual) {
+            maxResidual = residual;
+        }
+        if(s->rttNs > maxRtt) {
+            maxRtt = s->rttNs;
+        }
+    }
+
+    est->refUs = refUs;
+    est->refNs = refNs + intercept;
+    est->nsPerUs = nsPerUs;
+    est->errorNs = maxResidual + (maxRtt / 2.0) + CLOCK_EST_DEVICE_RES_NS;
+    est->used = n;
+    est->valid = true;
+}
@@ -0,0 +1,48 @@
+#ifndef _CLOCK_EST_H_
+#define _CLOCK_EST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Estimates the mapping from the device's microsecond clock to the host's
+ * CLOCK_MONOTONIC clock.
+ *
+ * Each sample is a device timestamp that is known to have been taken between
+ * two host timestamps (the start and end of a VENDOR_REQ_CLOCK_SYNC transfer).
+ * The device time is matched with the midpoint, so a sample is only as good as
+ * half its round trip time. Only the samples with the shortest round trips are
+ * used to fit the offset and drift with a least squares line.
+ */
+
+/*! @brief Number of recent samples the fit is made over */
+#define CLOCK_EST_SAMPLES   64
+
+/*! @brief Resolution of the device clock in nanoseconds */
+#define CLOCK_EST_DEVICE_RES_NS 4000
+
+typedef struct {
+    int64_t deviceUs;   // Unwrapped device time
+    int64_t hostNs;     // Host time at the middle of the transfer
+    int64_t rttNs;      // Round trip time of the transfer
+} clock_sample_t;
+
+typedef struct {
+    clock_sample_t samples[CLOCK_EST_SAMPLES];
+    int count;
+    int next;
+    int64_t lastDeviceUs;   // Most recent unwrapped device time
+    bool valid;             // True once a fit has been made
+    int64_t refUs;          // Device time the fit is relative to
+    double refNs;           // Host time at refUs
+    double nsPerUs;         // Host nanoseconds per device microsecond
+    double errorNs;         // Bound on the error of a translated time
+    int used;               // Samples used by the last fit
+} clock_est_t;
+
+void clock_est_init(clock_est_t *est);
+void clock_est_add(clock_est_t *est, uint32_t deviceUs, int64_t hostBeforeNs, int64_t hostAfterNs);
+bool clock_est_toHost(const clock_est_t *est, uint32_t deviceUs, int64_t *hostNs);
+double clock_est_driftPpm(const clock_est_t *est);
+
+#endif // _CLOCK_EST_H_
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libusb-1.0/libusb.h>
+#include "clock_est.h"
+
+#define VENDOR_ID   0xdead   // Replace with your USB device's vendor ID
+#define PRODUCT_ID  0xbeef   // Replace with your USB device's product ID
+
+// Vendor requests, see src/usb.c
+#define VENDOR_REQ_CLOCK_SYNC   0x0A
+#define CLOCK_SYNC_SIZE         10
+
+static int64_t nowNs(void);
+static uint32_t le32(const uint8_t *data);
+
+libusb_context* ctx = NULL;
+libusb_device_handle* dev_handle = NULL;
+
+int main(int argc, char **argv) {
+    clock_est_t est;
+    uint8_t reply[CLOCK_SYNC_SIZE];
+    int intervalMs = 100;
+    int count = 0;
+
+    if(argc > 1) intervalMs = strtoul(argv[1], NULL, 0);
+    if(argc > 2) count = strtoul(argv[2], NULL, 0);
+
+    // Initialize libusb
+    if (libusb_init(&ctx) != 0) {
+        fprintf(stderr, "libusb initialization failed\n");
+        return 1;
+    }
+
+    // Open the USB device using vendor and product ID
+    dev_handle = libusb_open_device_with_vid_pid(ctx, VENDOR_ID, PRODUCT_ID);
+    if (dev_handle == NULL) {
+        fprintf(stderr, "Could not open USB device\n");
+        libusb_exit(ctx);
+        return 1;
+    }
+
+    clock_est_init(&est);
+
+    // Run forever unless a sample count was given
+    for(int i = 0; (count == 0) || (i < count); i++) {
+        // The device timestamps the setup packet, which it
+        // receives somewhere between these two host times
+        int64_t before = nowNs();
+        int result = libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
+            VENDOR_REQ_CLOCK_SYNC, 0, 0, reply, sizeof(reply), 1000);
+        int64_t after = nowNs();
+
+        if(result != sizeof(reply)) {
+            fprintf(stderr, "Clock sync request failed: %s\n", libusb_error_name(result));
+            break;
+        }
+
+        uint32_t setupUs = le32(&reply[0]);
+        uint32_t sofUs = le32(&reply[4]);
+        uint16_t frame = reply[8] | (reply[9] << 8);
+
+        clock_est_add(&est, setupUs, before, after);
+
+        // Translate the last start of frame into host time as an example
+        // of mapping any device timestamp
+        int64_t sofNs = 0;
+        clock_est_toHost(&est, sofUs, &sofNs);
+
+        printf("rtt %6.1fus  offset %.3fms  drift %+8.2fppm  error +/-%6.1fus  (%d samples)  SOF %4u at %.6fs\n",
+            (after - before) / 1e3,
+            (est.refNs - (est.refUs * 1e3)) / 1e6,
+            clock_est_driftPpm(&est),
+            est.errorNs / 1e3,
+            est.used,
+            frame,
+            sofNs / 1e9);
+
+        struct timespec delay = {intervalMs / 1000, (intervalMs % 1000) * 1000000L};
+        nanosleep(&delay, NULL);
+    }
+
+    // Close the device and exit
+    libusb_close(dev_handle);
+    libusb_exit(ctx);
+
+    return 0;
+}
+
+static int64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static uint32_t le32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libusb-1.0/libusb.h>
+
+#define VENDOR_ID   0xdead   // Replace with your USB device's vendor ID
+#define PRODUCT_ID  0xbeef   // Replace with your USB device's product ID
+
+#define BULK_OUT_EP     (LIBUSB_ENDPOINT_OUT | 0x02)
+#define BULK_IN_EP      (LIBUSB_ENDPOINT_IN | 0x03)
+#define BULK_EP_SIZE    64
+
+// Command framing, see src/cmd.h
+#define CMD_HEADER_SIZE 3
+#define CMD_OP_NOP      0x00
+#define CMD_OP_ECHO     0x01
+#define CMD_STATUS_OK   0x00
+#define CMD_MAX_PAYLOAD (BULK_EP_SIZE - CMD_HEADER_SIZE)
+
+#define NUM_OUT_XFERS   4                   // Bulk OUT transfers kept in flight
+#define NUM_IN_XFERS    4                   // Bulk IN transfers kept in flight
+#define OUT_XFER_SIZE   (4 * BULK_EP_SIZE)  // Commands packed per OUT transfer
+#define IN_XFER_SIZE    (8 * BULK_EP_SIZE)  // Completions received per IN transfer
+#define MAX_WINDOW      128                 // Sequence numbers are 8 bits, keep them unambiguous
+
+static void fillCommands(struct libusb_transfer *xfer);
+static void LIBUSB_CALL onOutComplete(struct libusb_transfer *xfer);
+static void LIBUSB_CALL onInComplete(struct libusb_transfer *xfer);
+
+libusb_context* ctx = NULL;
+libusb_device_handle* dev_handle = NULL;
+
+static uint32_t total_cmds = 10000;
+static uint32_t window = MAX_WINDOW;
+static uint32_t echo_len = 1;
+static uint32_t sent = 0;
+static uint32_t completed = 0;
+static uint32_t failed = 0;
+static int out_idle = 0;
+static bool stop = false;
+static struct libusb_transfer *out_idle_xfers[NUM_OUT_XFERS];
+
+int main(int argc, char **argv) {
+    struct libusb_transfer *out_xfers[NUM_OUT_XFERS];
+    struct libusb_transfer *in_xfers[NUM_IN_XFERS];
+    struct timespec start, end;
+
+    if(argc > 1) total_cmds = strtoul(argv[1], NULL, 0);
+    if(argc > 2) window = strtoul(argv[2], NULL, 0);
+    if(argc > 3) echo_len = strtoul(argv[3], NULL, 0);
+    if((window == 0) || (window > MAX_WINDOW)) window = MAX_WINDOW;
+    if(echo_len > CMD_MAX_PAYLOAD) {
+        fprintf(stderr, "ECHO payload can be at most %d bytes\n", CMD_MAX_PAYLOAD);
+        return 1;
+    }
+
+    // Initialize libusb
+    if (libusb_init(&ctx) != 0) {
+        fprintf(stderr, "libusb initialization failed\n");
+        return 1;
+    }
+
+    // Open the USB device using vendor and product ID
+    dev_handle = libusb_open_device_with_vid_pid(ctx, VENDOR_ID, PRODUCT_ID);
+    if (dev_handle == NULL) {
+        fprintf(stderr, "Could not open USB device\n");
+        libusb_exit(ctx);
+        return 1;
+    }
+
+    // Claim the interface
+    if(libusb_claim_interface(dev_handle, 0) < 0) {
+        fprintf(stderr, "Could not claim interface\n");
+        libusb_close(dev_handle);
+        libusb_exit(ctx);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Keep several IN transfers queued so completions are always collected
+    for(int i = 0; i < NUM_IN_XFERS; i++) {
+        in_xfers[i] = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(in_xfers[i], dev_handle, BULK_IN_EP,
+            malloc(IN_XFER_SIZE), IN_XFER_SIZE, onInComplete, NULL, 0);
+        in_xfers[i]->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+        libusb_submit_transfer(in_xfers[i]);
+    }
+
+    // Prime the command pipeline
+    for(int i = 0; i < NUM_OUT_XFERS; i++) {
+        out_xfers[i] = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(out_xfers[i], dev_handle, BULK_OUT_EP,
+            malloc(OUT_XFER_SIZE), 0, onOutComplete, NULL, 1000);
+        out_xfers[i]->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+        fillCommands(out_xfers[i]);
+    }
+
+    while(!stop && (completed < total_cmds)) {
+        libusb_handle_events(ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9);
+    printf("%u commands in %.3fs (%.0f commands/s), %u failed\n",
+        completed, elapsed, completed / elapsed, failed);
+
+    // Cancel the outstanding IN transfers and let them drain
+    for(int i = 0; i < NUM_IN_XFERS; i++) {
+        libusb_cancel_transfer(in_xfers[i]);
+    }
+    stop = true;
+    struct timeval tv = {0, 100000};
+    libusb_handle_events_timeout(ctx, &tv);
+
+    // Close the device and exit
+    libusb_release_interface(dev_handle, 0);
+    libusb_close(dev_handle);
+    libusb_exit(ctx);
+
+    return failed ? 1 : 0;
+}
+
+static void fillCommands(struct libusb_transfer *xfer) {
+    int len = 0;
+
+    // Pack as many commands as fit in the transfer and our window
+    while((sent < total_cmds) && ((sent - completed) < window)) {
+        uint8_t seq = sent & 0xFF;
+        // Alternate between a NOP and an ECHO of the sequence number. With
+        // the largest payload each ECHO completion fills a bank exactly.
+        uint8_t payloadLen = (seq & 0x01) ? echo_len : 0;
+
+        if((len + CMD_HEADER_SIZE + payloadLen) > OUT_XFER_SIZE) {
+            break;
+        }
+
+        xfer->buffer[len++] = seq;
+        xfer->buffer[len++] = (seq & 0x01) ? CMD_OP_ECHO : CMD_OP_NOP;
+        xfer->buffer[len++] = payloadLen;
+        memset(&xfer->buffer[len], seq, payloadLen);
+        len += payloadLen;
+        sent++;
+    }
+
+    if(len == 0) {
+        // Nothing to send right now, park the transfer until completions free up the window
+        out_idle_xfers[out_idle++] = xfer;
+        return;
+    }
+
+    xfer->length = len;
+    if(libusb_submit_transfer(xfer) < 0) {
+        fprintf(stderr, "Could not submit command transfer\n");
+        stop = true;
+    }
+}
+
+static void LIBUSB_CALL onOutComplete(struct libusb_transfer *xfer) {
+    if(xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        fprintf(stderr, "Command transfer failed: %d\n", xfer->status);
+        stop = true;
+        return;
+    }
+
+    fillCommands(xfer);
+}
+
+static void LIBUSB_CALL onInComplete(struct libusb_transfer *xfer) {
+    if(xfer->status == LIBUSB_TRANSFER_CANCELLED) {
+        return;
+    }
+
+    if(xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        fprintf(stderr, "Completion transfer failed: %d\n", xfer->status);
+        stop = true;
+        return;
+    }
+
+    // Completions are whole records and arrive in command order
+    int i = 0;
+    while((i + CMD_HEADER_SIZE) <= xfer->actual_length) {
+        uint8_t seq = xfer->buffer[i];
+        uint8_t status = xfer->buffer[i + 1];
+        uint8_t len = xfer->buffer[i + 2];
+
+        bool ok = (seq == (completed & 0xFF)) && (status == CMD_STATUS_OK) &&
+                  (len == ((seq & 0x01) ? echo_len : 0)) &&
+                  ((i + CMD_HEADER_SIZE + len) <= xfer->actual_length);
+        for(int j = 0; ok && (j < len); j++) {
+            ok = (xfer->buffer[i + CMD_HEADER_SIZE + j] == seq);
+        }
+        if(!ok) {
+            failed++;
+        }
+
+        completed++;
+        i += CMD_HEADER_SIZE + len;
+    }
+
+    // The window has room again, wake any parked command transfers
+    while(out_idle) {
+        int parked = out_idle;
+        fillCommands(out_idle_xfers[--out_idle]);
+        // Stop once a transfer gets parked again
+        if(out_idle == parked) break;
+    }
+
+    if(!stop && (completed < total_cmds)) {
+        libusb_submit_transfer(xfer);
+    }
+}
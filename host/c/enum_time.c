@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libusb-1.0/libusb.h>
+
+#define VENDOR_ID   0xdead   // Replace with your USB device's vendor ID
+#define PRODUCT_ID  0xbeef   // Replace with your USB device's product ID
+
+// Vendor requests, see src/usb.c
+#define VENDOR_REQ_REGISTRY_READ    0x03
+
+// Registry ids of the enumeration statistics, see src/main.c
+#define VAR_ID_USB_ENUM_RESETS      8
+#define VAR_ID_USB_ENUM_US          9
+#define VAR_ID_USB_ENUM_REQUESTS    10
+#define VAR_ID_USB_ENUM_STALLS      11
+#define ENUM_STATS_MASK             ((1 << VAR_ID_USB_ENUM_RESETS) | (1 << VAR_ID_USB_ENUM_US) | \
+                                     (1 << VAR_ID_USB_ENUM_REQUESTS) | (1 << VAR_ID_USB_ENUM_STALLS))
+#define ENUM_STATS_SIZE             12
+
+#define REOPEN_TIMEOUT_MS   5000
+
+static double nowMs(void);
+static bool reopen(void);
+
+libusb_context* ctx = NULL;
+libusb_device_handle* dev_handle = NULL;
+
+int main(int argc, char **argv) {
+    uint8_t stats[ENUM_STATS_SIZE];
+    int iterations = 20;
+    int done = 0;
+    int bad = 0;
+    double hostMin = 1e9, hostMax = 0, hostSum = 0;
+    double devMin = 1e9, devMax = 0, devSum = 0;
+
+    if(argc > 1) iterations = strtoul(argv[1], NULL, 0);
+
+    // Initialize libusb
+    if (libusb_init(&ctx) != 0) {
+        fprintf(stderr, "libusb initialization failed\n");
+        return 1;
+    }
+
+    // Open the USB device using vendor and product ID
+    dev_handle = libusb_open_device_with_vid_pid(ctx, VENDOR_ID, PRODUCT_ID);
+    if (dev_handle == NULL) {
+        fprintf(stderr, "Could not open USB device\n");
+        libusb_exit(ctx);
+        return 1;
+    }
+
+    for(int i = 0; i < iterations; i++) {
+        // The kernel resets the port, enumerates the device again and
+        // restores its configuration before this returns
+        double start = nowMs();
+        int result = libusb_reset_device(dev_handle);
+        double hostMs = nowMs() - start;
+
+        if(result == LIBUSB_ERROR_NOT_FOUND) {
+            // The device came back looking different and was re-enumerated
+            // as a new device. Find it again.
+            if(!reopen()) {
+                fprintf(stderr, "Device did not come back after reset %d\n", i);
+                break;
+            }
+            hostMs = nowMs() - start;
+        }
+        else if(result < 0) {
+            fprintf(stderr, "Reset %d failed: %s\n", i, libusb_error_name(result));
+            break;
+        }
+
+        // Read the device's view of the enumeration we just caused
+        result = libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
+            VENDOR_REQ_REGISTRY_READ, ENUM_STATS_MASK & 0xFFFF, ENUM_STATS_MASK >> 16,
+            stats, sizeof(stats), 1000);
+        if(result != sizeof(stats)) {
+            fprintf(stderr, "Reading enumeration stats failed: %s\n", libusb_error_name(result));
+            break;
+        }
+
+        // Values are packed in ascending id order, little endian
+        uint32_t resets = stats[0] | (stats[1] << 8) | (stats[2] << 16) | ((uint32_t)stats[3] << 24);
+        uint32_t micros = stats[4] | (stats[5] << 8) | (stats[6] << 16) | ((uint32_t)stats[7] << 24);
+        uint16_t requests = stats[8] | (stats[9] << 8);
+        uint16_t stalls = stats[10] | (stats[11] << 8);
+        double devMs = micros / 1000.0;
+
+        printf("reset %3d: host %7.1fms  device %7.1fms  %2u requests  %u stalls  (%u bus resets)\n",
+            i, hostMs, devMs, requests, stalls, resets);
+
+        // A stalled request means the host had to retry or skip something
+        if(stalls || (micros == 0)) {
+            bad++;
+        }
+
+        if(hostMs < hostMin) hostMin = hostMs;
+        if(hostMs > hostMax) hostMax = hostMs;
+        if(devMs < devMin) devMin = devMs;
+        if(devMs > devMax) devMax = devMs;
+        hostSum += hostMs;
+        devSum += devMs;
+        done++;
+    }
+
+    if(done) {
+        printf("host:   min %.1fms  avg %.1fms  max %.1fms\n", hostMin, hostSum / done, hostMax);
+        printf("device: min %.1fms  avg %.1fms  max %.1fms (bus reset to SET_CONFIGURATION)\n",
+            devMin, devSum / done, devMax);
+        printf("%d of %d enumerations had stalled requests\n", bad, done);
+    }
+
+    // Close the device and exit
+    if(dev_handle) {
+        libusb_close(dev_handle);
+    }
+    libusb_exit(ctx);
+
+    return ((done == iterations) && !bad) ? 0 : 1;
+}
+
+static double nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+static bool reopen(void) {
+    double start = nowMs();
+
+    libusb_close(dev_handle);
+    dev_handle = NULL;
+
+    while((nowMs() - start) < REOPEN_TIMEOUT_MS) {
+        dev_handle = libusb_open_device_with_vid_pid(ctx, VENDOR_ID, PRODUCT_ID);
+        if(dev_handle != NULL) {
+            return true;
+        }
+        struct timespec delay = {0, 10000000L};
+        nanosleep(&delay, NULL);
+    }
+
+    return false;
+}
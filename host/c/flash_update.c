@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libusb-1.0/libusb.h>
+
+#define VENDOR_ID   0xdead   // Replace with your USB device's vendor ID
+#define PRODUCT_ID  0xbeef   // Replace with your USB device's product ID
+
+// Vendor requests, see src/usb.c and src/updater.h
+#define VENDOR_REQ_UPDATE_INFO      0x06
+#define VENDOR_REQ_UPDATE_HASH      0x07
+#define VENDOR_REQ_UPDATE_WRITE     0x08
+#define VENDOR_REQ_UPDATE_REBOOT    0x09
+
+#define FLASH_SIZE          (32 * 1024)
+#define MAX_PAGE_SIZE       256
+#define HASHES_PER_REQUEST  64
+#define UPDATE_INFO_SIZE    5
+#define UPDATE_INFO_UPDATER 0x01    // Set in the info when the updater is running, see src/update.h
+
+static bool loadHex(const char *path, uint8_t *image, bool *programmed);
+static uint16_t crc16(const uint8_t *data, uint16_t len);
+static bool readInfo(uint16_t *pageSize, uint16_t *numPages, bool *inUpdater);
+static int readHashes(uint16_t *hashes, uint16_t start, uint16_t numPages);
+static bool writePage(uint16_t page, uint16_t pageSize);
+static bool enterUpdater(void);
+
+libusb_context* ctx = NULL;
+libusb_device_handle* dev_handle = NULL;
+
+static uint8_t image[FLASH_SIZE];
+static bool programmed[FLASH_SIZE];
+
+int main(int argc, char **argv) {
+    uint16_t deviceHashes[FLASH_SIZE / 64];
+    uint16_t pageSize, numPages;
+    int changed = 0;
+    int ret = 1;
+
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <firmware.hex>\n", argv[0]);
+        return 1;
+    }
+
+    // Unprogrammed flash reads back as 0xFF
+    memset(image, 0xFF, sizeof(image));
+    if(!loadHex(argv[1], image, programmed)) {
+        return 1;
+    }
+
+    // Initialize libusb
+    if (libusb_init(&ctx) != 0) {
+        fprintf(stderr, "libusb initialization failed\n");
+        return 1;
+    }
+
+    // Open the device using vendor and product ID. The updater is the
+    // same device, so this finds it too if an earlier update was interrupted.
+    dev_handle = libusb_open_device_with_vid_pid(ctx, VENDOR_ID, PRODUCT_ID);
+    if (dev_handle == NULL) {
+        fprintf(stderr, "Could not open USB device\n");
+        libusb_exit(ctx);
+        return 1;
+    }
+
+    // Hand the device over to the updater and find out
+    // how its flash is laid out
+    if(!enterUpdater() || !readInfo(&pageSize, &numPages, NULL)) {
+        goto exit;
+    }
+
+    // Only consider pages up to the last one the image programs. Anything past
+    // the updatable area (i.e. the boot section) is left alone.
+    uint16_t imagePages = 0;
+    for(uint32_t addr = 0; addr < ((uint32_t)pageSize * numPages); addr++) {
+        if(programmed[addr]) {
+            imagePages = (addr / pageSize) + 1;
+        }
+    }
+
+    if(readHashes(deviceHashes, 0, imagePages) < 0) {
+        goto exit;
+    }
+
+    // Only write the pages whose contents differ, leaving page 0 for last.
+    // The updater swaps in a recovery page 0 while the others change so an
+    // interrupted update comes back to it rather than a broken application.
+    for(int page = 1; page < imagePages; page++) {
+        if(crc16(&image[page * pageSize], pageSize) == deviceHashes[page]) {
+            continue;
+        }
+
+        if(!writePage(page, pageSize)) {
+            goto exit;
+        }
+        changed++;
+    }
+
+    // Every other page must verify before page 0 makes the application bootable
+    if(readHashes(deviceHashes, 0, imagePages) < 0) {
+        goto exit;
+    }
+
+    for(int page = 1; page < imagePages; page++) {
+        if(crc16(&image[page * pageSize], pageSize) != deviceHashes[page]) {
+            fprintf(stderr, "Page %d failed to verify\n", page);
+            goto exit;
+        }
+    }
+
+    if(imagePages && (crc16(image, pageSize) != deviceHashes[0])) {
+        if(!writePage(0, pageSize)) {
+            goto exit;
+        }
+        changed++;
+
+        if((readHashes(deviceHashes, 0, 1) < 0) || (crc16(image, pageSize) != deviceHashes[0])) {
+            fprintf(stderr, "Page 0 failed to verify\n");
+            goto exit;
+        }
+    }
+
+    printf("Updated %d of %d pages\n", changed, imagePages);
+
+    // Restart into the new application. The device drops off the bus
+    // so the status stage may or may not make it back to us.
+    libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR,
+        VENDOR_REQ_UPDATE_REBOOT, 0, 0, NULL, 0, 1000);
+
+    ret = 0;
+
+exit:
+    // Close the device and exit
+    libusb_close(dev_handle);
+    libusb_exit(ctx);
+
+    return ret;
+}
+
+// Starts the updater unless it is already running. It takes over the
+// application's USB link, so we carry on with the same handle.
+static bool enterUpdater(void) {
+    uint16_t pageSize, numPages;
+    bool inUpdater;
+
+    // The application reports no pages if it was flashed without the updater
+    if(!readInfo(&pageSize, &numPages, &inUpdater)) {
+        return false;
+    }
+
+    if(inUpdater) {
+        return true;
+    }
+
+    if(libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR,
+            VENDOR_REQ_UPDATE_REBOOT, 0, 0, NULL, 0, 1000) < 0) {
+        fprintf(stderr, "Could not start the updater\n");
+        return false;
+    }
+
+    if(!readInfo(&pageSize, &numPages, &inUpdater) || !inUpdater) {
+        fprintf(stderr, "The updater did not start\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool readInfo(uint16_t *pageSize, uint16_t *numPages, bool *inUpdater) {
+    uint8_t info[UPDATE_INFO_SIZE];
+
+    if(libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
+            VENDOR_REQ_UPDATE_INFO, 0, 0, info, sizeof(info), 1000) != sizeof(info)) {
+        fprintf(stderr, "Could not read update info\n");
+        return false;
+    }
+
+    *pageSize = info[0] | (info[1] << 8);
+    *numPages = info[2] | (info[3] << 8);
+    if(inUpdater != NULL) {
+        *inUpdater = (info[4] & UPDATE_INFO_UPDATER);
+    }
+
+    if((*numPages == 0) || (*pageSize == 0) || (*pageSize > MAX_PAGE_SIZE) || ((uint32_t)*pageSize * *numPages > FLASH_SIZE)) {
+        fprintf(stderr, "Device does not support in-application updates\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool writePage(uint16_t page, uint16_t pageSize) {
+    int result = libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR,
+        VENDOR_REQ_UPDATE_WRITE, page, 0, &image[page * pageSize], pageSize, 1000);
+
+    if(result != pageSize) {
+        fprintf(stderr, "Writing page %d failed: %s\n", page, libusb_error_name(result));
+        return false;
+    }
+
+    return true;
+}
+
+static int readHashes(uint16_t *hashes, uint16_t start, uint16_t numPages) {
+    uint8_t buff[HASHES_PER_REQUEST * 2];
+
+    for(uint16_t first = start; first < (start + numPages); first += HASHES_PER_REQUEST) {
+        uint16_t count = (start + numPages) - first;
+        if(count > HASHES_PER_REQUEST) {
+            count = HASHES_PER_REQUEST;
+        }
+
+        int result = libusb_control_transfer(dev_handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
+            VENDOR_REQ_UPDATE_HASH, first, count, buff, count * 2, 1000);
+        if(result != (count * 2)) {
+            fprintf(stderr, "Reading page hashes failed: %s\n", libusb_error_name(result));
+            return -1;
+        }
+
+        for(uint16_t i = 0; i < count; i++) {
+            hashes[first + i] = buff[i * 2] | (buff[(i * 2) + 1] << 8);
+        }
+    }
+
+    return 0;
+}
+
+// Same CRC-16 (poly 0xA001, init 0xFFFF) as avr-libc's _crc16_update()
+static uint16_t crc16(const uint8_t *data, uint16_t len) {
+    uint16_t crc = 0xFFFF;
+
+    for(uint16_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for(uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+
+    return crc;
+}
+
+static uint8_t hexByte(const char *str) {
+    char byte[3] = {str[0], str[1], 0};
+    return strtoul(byte, NULL, 16);
+}
+
+// Parse an Intel HEX file into a flat flash image
+static bool loadHex(const char *path, uint8_t *image, bool *programmed) {
+    char line[600];
+    uint32_t base = 0;
+    int lineNum = 0;
+    FILE *f = fopen(path, "r");
+
+    if(f == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        lineNum++;
+        if(line[0] != ':') {
+            continue;
+        }
+
+        uint8_t len = hexByte(&line[1]);
+        uint16_t addr = (hexByte(&line[3]) << 8) | hexByte(&line[5]);
+        uint8_t type = hexByte(&line[7]);
+        uint8_t sum = len + (addr >> 8) + (addr & 0xFF) + type;
+
+        if(strlen(line) < (11 + (len * 2))) {
+            fprintf(stderr, "%s:%d: truncated record\n", path, lineNum);
+            fclose(f);
+            return false;
+        }
+
+        uint8_t data[256];
+        for(int i = 0; i < len; i++) {
+            data[i] = hexByte(&line[9 + (i * 2)]);
+            sum += data[i];
+        }
+
+        if((uint8_t)(sum + hexByte(&line[9 + (len * 2)])) != 0) {
+            fprintf(stderr, "%s:%d: bad checksum\n", path, lineNum);
+            fclose(f);
+            return false;
+        }
+
+        switch(type) {
+            case 0x00: // Data
+                if((base + addr + len) > FLASH_SIZE) {
+                    fprintf(stderr, "%s:%d: data outside of flash\n", path, lineNum);
+                    fclose(f);
+                    return false;
+                }
+                memcpy(&image[base + addr], data, len);
+                memset(&programmed[base + addr], true, len);
+                break;
+
+            case 0x01: // End of file
+                fclose(f);
+                return true;
+
+            case 0x02: // Extended segment address
+                base = ((data[0] << 8) | data[1]) << 4;
+                break;
+
+            case 0x04: // Extended linear address
+                base = ((uint32_t)((data[0] << 8) | data[1])) << 16;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
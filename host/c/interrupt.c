@@ -4,27 +4,19 @@
 #include <string.h>
 #include <unistd.h>
 #include <libusb-1.0/libusb.h>
+#include "protocol.h"
 
 #define VENDOR_ID   0xdead   // Replace with your USB device's vendor ID
 #define PRODUCT_ID  0xbeef   // Replace with your USB device's product ID
 
-typedef union {
-    struct {
-        uint8_t sw0     : 1;
-        uint8_t sw1     : 1;
-        uint8_t sw2     : 1;
-        uint8_t rsvd    : 5;
-    } bits;
-    uint8_t byte;
-} pb_status_t;
-
 static bool sendControlTransfer(uint16_t val);
-static int rxInterruptData(uint8_t *pb_report);
+static int rxInterruptData(uint8_t *report);
 
 libusb_context* ctx = NULL;
 libusb_device_handle* dev_handle = NULL;
 
 int main() {
+    uint8_t report[PROTOCOL_REPORT_SIZE];
     pb_status_t pb_status = {0x00};
     pb_status_t prev_pb_status = {0x00};
     uint16_t led_flash_rate = 0x00;
@@ -57,14 +49,36 @@ int main() {
 
     int rxBytes = 0;
     while(1) {
-        rxBytes = rxInterruptData(&pb_status.byte);
+        rxBytes = rxInterruptData(report);
+
+        if((rxBytes < PROTOCOL_HEADER_SIZE) || (report[0] != PROTOCOL_VERSION)) {
+            if(rxBytes) {
+                fprintf(stderr, "Ignoring report with unknown format\n");
+            }
+            continue;
+        }
+
+        uint8_t count = report[1];
+        uint8_t dropped = report[2];
+        uint32_t time = report[4] | (report[5] << 8) | (report[6] << 16) | ((uint32_t)report[7] << 24);
+
+        if(dropped) {
+            printf("Device dropped %d button changes\n", dropped);
+        }
+
+        // Handle every state change the report carries, in order
+        for(int i = 0; (i < count) && ((PROTOCOL_HEADER_SIZE + ((i + 1) * PROTOCOL_SAMPLE_SIZE)) <= rxBytes); i++) {
+            const uint8_t *raw = &report[PROTOCOL_HEADER_SIZE + (i * PROTOCOL_SAMPLE_SIZE)];
+            uint16_t sample = raw[0] | (raw[1] << 8);
+
+            time += PROTOCOL_SAMPLE_DELTA(sample) * PROTOCOL_SAMPLE_DELTA_US;
+            pb_status.byte = PROTOCOL_SAMPLE_STATE(sample);
 
-        if(rxBytes && pb_status.byte) {
             if(pb_status.bits.sw0 && !prev_pb_status.bits.sw0) {
                 if(led_flash_rate < 2500)
                     led_flash_rate += 100;
 
-                printf("Increase delay to %dms\n", led_flash_rate);
+                printf("[%10u us] Increase delay to %dms\n", time, led_flash_rate);
 
                 if(start_stop) {
                     sendControlTransfer(led_flash_rate);
@@ -74,7 +88,7 @@ int main() {
                 if(led_flash_rate >= 100)
                     led_flash_rate -= 100;
 
-                printf("Decrease delay to %dms\n", led_flash_rate);
+                printf("[%10u us] Decrease delay to %dms\n", time, led_flash_rate);
 
                 if(start_stop) {
                     sendControlTransfer(led_flash_rate);
@@ -83,16 +97,14 @@ int main() {
             else if(pb_status.bits.sw2 && !prev_pb_status.bits.sw2) {
                 start_stop = !start_stop;
 
-                printf("Start/Stop: %d\n", start_stop);
+                printf("[%10u us] Start/Stop: %d\n", time, start_stop);
 
                 sendControlTransfer((start_stop ? led_flash_rate : 0));
             }
-        }
 
-        // Clear our RX bytes
-        rxBytes = 0;
-        // Store our previous PB status
-        prev_pb_status = pb_status;
+            // Store our previous PB status
+            prev_pb_status = pb_status;
+        }
     }
 
     // Close the device and exit
@@ -122,13 +134,13 @@ static bool sendControlTransfer(uint16_t val) {
     }
 }
 
-static int rxInterruptData(uint8_t *pb_report) {
+static int rxInterruptData(uint8_t *report) {
     int readBytes = 0;
     int ret = libusb_interrupt_transfer(
         dev_handle,
         LIBUSB_ENDPOINT_IN | 0x01,
-        pb_report,
-        1,
+        report,
+        PROTOCOL_REPORT_SIZE,
         &readBytes,
         0
     );
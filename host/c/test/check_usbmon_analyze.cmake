@@ -0,0 +1,19 @@
+# Runs usbmon_analyze on the recorded capture and compares its report with
+# the expected one. Regenerate both after an intended change with
+#   python3 make_usbmon_capture.py
+#   usbmon_analyze usbmon_capture.pcap > usbmon_capture.expected
+execute_process(
+    COMMAND ${ANALYZER} ${CAPTURE}
+    OUTPUT_VARIABLE actual
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE result
+)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "usbmon_analyze failed (${result}):\n${errors}")
+endif()
+
+file(READ ${EXPECTED} expected)
+if(NOT actual STREQUAL expected)
+    message(FATAL_ERROR "Report differs from ${EXPECTED}:\n${actual}")
+endif()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Writes usbmon_capture.pcap, the capture the usbmon_analyze test runs on.
+
+It's a made up usbmon (DLT_USB_LINUX_MMAPPED) capture of dead:beef at 1:5:
+its device descriptor, vendor 0x01 (Control Write) and 0x02 (Control Read)
+requests with one slow and one STALLed, interrupt IN reports with one held
+for 200ms while the buttons are idle (which isn't NAK heavy), and a bulk
+transfer from another device at 1:7 that must not show up in the report.
+"""
+import os
+import struct
+
+DLT_USB_LINUX_MMAPPED = 220
+XFER_INTERRUPT = 1
+XFER_CONTROL = 2
+XFER_BULK = 3
+EPIPE = -32
+EINPROGRESS = -115
+
+DEVICE_DESCRIPTOR = bytes([0x12, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x08,
+                           0xad, 0xde, 0xef, 0xbe, 0x01, 0x00, 0x01, 0x02, 0x03, 0x01])
+
+events = []
+urb_id = 0
+
+
+def event(urb, kind, xfer_type, ep, dev, t_us, status, length, data=b"", setup=None, interval=0):
+    header = struct.pack("<QBBBBHbbqiiII8siiII",
+                         urb, ord(kind), xfer_type, ep, dev, 1,
+                         0 if setup is not None else ord("-"),
+                         0 if data else ord("<"),
+                         t_us // 1000000, t_us % 1000000, status, length, len(data),
+                         setup or bytes(8), interval, 0, 0, 0)
+    events.append((t_us, header + data))
+
+
+def transfer(t_us, us, xfer_type, ep, dev=5, setup=None, status=0, reply=b"", interval=0):
+    global urb_id
+    urb_id += 1
+    length = len(reply) if reply else (setup[6] | (setup[7] << 8) if setup else 64)
+    event(urb_id, "S", xfer_type, ep, dev, t_us, EINPROGRESS, length, setup=setup, interval=interval)
+    event(urb_id, "C", xfer_type, ep, dev, t_us + us, status, len(reply), data=reply, interval=interval)
+
+
+def vendor_in(t_us, us, request, status=0):
+    transfer(t_us, us, XFER_CONTROL, 0x80, setup=bytes([0xc0, request, 0, 0, 0, 0, 1, 0]),
+             status=status, reply=b"\x01" if status == 0 else b"")
+
+
+def vendor_out(t_us, us, request, status=0):
+    # No data stage, the value travels in wValue
+    transfer(t_us, us, XFER_CONTROL, 0x00, setup=bytes([0x40, request, 1, 0, 0, 0, 0, 0]),
+             status=status)
+
+
+t = 1000000
+transfer(t, 300, XFER_CONTROL, 0x80, setup=bytes([0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x12, 0x00]),
+         reply=DEVICE_DESCRIPTOR)
+
+# Ten of each vendor request, 0x01 in the 256-511us bin and 0x02 in the 512-1023us bin
+for i in range(10):
+    t += 10000
+    vendor_out(t, 300, 0x01)
+    t += 10000
+    vendor_in(t, 600, 0x02)
+
+# One 0x01 NAKed for 3ms, one 0x02 that STALLs after 5ms
+t += 10000
+vendor_out(t, 3000, 0x01)
+t += 10000
+vendor_in(t, 5000, 0x02, status=EPIPE)
+
+# Reports every 32ms, then nothing for 200ms while the buttons are left alone
+for i in range(5):
+    t += 1000
+    transfer(t, 32000, XFER_INTERRUPT, 0x81, reply=bytes(10), interval=32)
+    t += 32000
+t += 1000
+transfer(t, 200000, XFER_INTERRUPT, 0x81, reply=bytes(10), interval=32)
+
+# Another device on the same bus
+transfer(t, 10000, XFER_BULK, 0x02, dev=7)
+
+out = struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, DLT_USB_LINUX_MMAPPED)
+for t_us, packet in sorted(events, key=lambda e: e[0]):
+    out += struct.pack("<IIII", t_us // 1000000, t_us % 1000000, len(packet), len(packet)) + packet
+
+with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), "usbmon_capture.pcap"), "wb") as f:
+    f.write(out)
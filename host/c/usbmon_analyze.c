@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define VENDOR_ID   0xdead   // Replace with your USB device's vendor ID
+#define PRODUCT_ID  0xbeef   // Replace with your USB device's product ID
+
+// Vendor requests worth naming, see src/usb.c
+#define VENDOR_REQ_WRITE_VAR    0x01
+#define VENDOR_REQ_READ_VAR     0x02
+
+// pcap link types carrying usbmon headers
+#define DLT_USB_LINUX           189     // 48 byte header
+#define DLT_USB_LINUX_MMAPPED   220     // 64 byte header
+
+// usbmon transfer types
+#define XFER_ISO        0
+#define XFER_INTERRUPT  1
+#define XFER_CONTROL    2
+#define XFER_BULK       3
+
+#define MAX_DEVICES     64
+#define MAX_STREAMS     32      // Kinds of transfer tracked per device
+#define MAX_PENDING     1024    // URBs submitted but not yet completed
+#define MAX_EVENTS      20      // STALLs and slow periods listed per device
+#define HIST_BINS       24      // Power of 2 latency bins, 1us to 8s
+#define EPIPE_STATUS    (-32)   // A STALL completes the URB with -EPIPE
+
+// Binary usbmon header, as read from /dev/usbmonN and stored in pcap files.
+// See Documentation/usb/usbmon.rst in the kernel sources.
+typedef struct __attribute__((packed)) {
+    uint64_t id;            // URB id, matches a submission with its completion
+    uint8_t type;           // 'S'ubmit, 'C'omplete or 'E'rror
+    uint8_t xfer_type;      // XFER_*
+    uint8_t epnum;          // Endpoint address, bit 7 set for IN
+    uint8_t devnum;
+    uint16_t busnum;
+    int8_t flag_setup;      // 0 if setup holds a setup packet
+    int8_t flag_data;       // 0 if data follows the header
+    int64_t ts_sec;
+    int32_t ts_usec;
+    int32_t status;
+    uint32_t length;        // Length of the transfer
+    uint32_t len_cap;       // Bytes of data that follow the header
+    uint8_t setup[8];
+    // The rest is only present in the 64 byte (mmapped) header
+    int32_t interval;       // Polling interval in frames
+    int32_t start_frame;
+    uint32_t xfer_flags;
+    uint32_t ndesc;         // ISO descriptors between the header and the data
+} usbmon_packet_t;
+
+// ioctl for reading one event from /dev/usbmonN
+typedef struct {
+    usbmon_packet_t *hdr;
+    void *data;
+    size_t alloc;
+} mon_get_arg_t;
+#define MON_IOC_MAGIC   0x92
+#define MON_IOCX_GETX   _IOW(MON_IOC_MAGIC, 10, mon_get_arg_t)
+
+typedef struct {
+    uint8_t xfer_type;
+    uint8_t epnum;
+    int16_t request;        // Vendor bRequest for control transfers, -1 for all others
+    uint32_t count;
+    uint32_t stalls;
+    uint32_t slow;          // Completed, but NAKed for much longer than the bus needs
+    uint32_t errors;
+    uint64_t minUs;
+    uint64_t maxUs;
+    uint64_t totalUs;
+    uint32_t hist[HIST_BINS];
+} stream_t;
+
+typedef struct {
+    double ts;              // Seconds since the start of the capture
+    uint64_t us;            // How long it took or was pending
+    int stream;
+} event_t;
+
+typedef struct {
+    uint16_t busnum;
+    uint8_t devnum;
+    uint16_t vid;
+    uint16_t pid;
+    bool identified;
+    int numStreams;
+    stream_t streams[MAX_STREAMS];
+    int numStalls;
+    event_t stalls[MAX_EVENTS];
+    int numSlow;
+    event_t slow[MAX_EVENTS];   // Kept sorted, longest first
+} device_t;
+
+typedef struct {
+    uint64_t id;
+    int64_t tsUs;
+    int device;
+    int stream;
+    bool descriptorRead;    // GET_DESCRIPTOR(Device), tells us the VID/PID
+} pending_t;
+
+static bool openPcap(FILE *f, int *linkType, bool *swapped);
+static bool readPcap(FILE *f, bool swapped, int linkType, usbmon_packet_t *hdr, uint8_t *data, uint32_t *dataLen);
+static void handleEvent(const usbmon_packet_t *hdr, const uint8_t *data, uint32_t dataLen);
+static device_t *findDevice(uint16_t busnum, uint8_t devnum, int *index);
+static int findStream(device_t *dev, const usbmon_packet_t *hdr);
+static void addSlow(device_t *dev, double ts, uint64_t us, int stream);
+static void printReport(void);
+static const char *streamName(const stream_t *stream, char *buff, size_t len);
+
+static device_t devices[MAX_DEVICES];
+static int numDevices = 0;
+static pending_t pending[MAX_PENDING];
+static int numPending = 0;
+static int64_t firstUs = -1;
+
+// Options
+static uint16_t matchVid = VENDOR_ID;
+static uint16_t matchPid = PRODUCT_ID;
+static int matchBus = -1;
+static int matchDev = -1;
+static uint64_t slowCtrlUs = 2000;     // Control and bulk transfers slower than this were NAKed a lot
+static uint32_t slowIntervals = 4;     // Interrupt transfers pending for this many intervals
+static uint32_t defaultIntervalMs = 32;
+static volatile bool stop = false;
+
+static void onSignal(int sig) {
+    (void)sig;
+    stop = true;
+}
+
+int main(int argc, char **argv) {
+    usbmon_packet_t hdr;
+    static uint8_t data[65536];
+    uint32_t dataLen;
+    long maxEvents = 0;
+    long events = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "v:d:t:n:i:c:")) != -1) {
+        switch(opt) {
+            case 'v':
+                if(sscanf(optarg, "%hx:%hx", &matchVid, &matchPid) != 2) goto usage;
+                break;
+            case 'd':
+                if(sscanf(optarg, "%d:%d", &matchBus, &matchDev) != 2) goto usage;
+                break;
+            case 't':
+                slowCtrlUs = strtoul(optarg, NULL, 0) * 1000;
+                break;
+            case 'n':
+                slowIntervals = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                defaultIntervalMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                maxEvents = strtol(optarg, NULL, 0);
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if(optind >= argc) {
+        goto usage;
+    }
+
+    const char *path = argv[optind];
+
+    if(strncmp(path, "/dev/usbmon", 11) == 0) {
+        // Live capture through the binary usbmon interface
+        int fd = open(path, O_RDONLY);
+        if(fd < 0) {
+            fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+
+        // Stop cleanly and print what we have on Ctrl-C
+        struct sigaction sa = {0};
+        sa.sa_handler = onSignal;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        fprintf(stderr, "Capturing from %s, Ctrl-C to stop\n", path);
+
+        while(!stop && ((maxEvents == 0) || (events < maxEvents))) {
+            mon_get_arg_t arg = {&hdr, data, sizeof(data)};
+            if(ioctl(fd, MON_IOCX_GETX, &arg) < 0) {
+                if(errno == EINTR) continue;
+                fprintf(stderr, "Reading %s failed: %s\n", path, strerror(errno));
+                break;
+            }
+            dataLen = (hdr.len_cap < sizeof(data)) ? hdr.len_cap : sizeof(data);
+            handleEvent(&hdr, data, dataLen);
+            events++;
+        }
+
+        close(fd);
+    }
+    else {
+        // Offline analysis of a saved capture
+        int linkType;
+        bool swapped;
+        FILE *f = fopen(path, "rb");
+
+        if(f == NULL) {
+            fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+
+        if(!openPcap(f, &linkType, &swapped)) {
+            fclose(f);
+            return 1;
+        }
+
+        while(((maxEvents == 0) || (events < maxEvents)) && readPcap(f, swapped, linkType, &hdr, data, &dataLen)) {
+            handleEvent(&hdr, data, dataLen);
+            events++;
+        }
+
+        fclose(f);
+    }
+
+    fprintf(stderr, "%ld events\n", events);
+    printReport();
+
+    return 0;
+
+usage:
+    fprintf(stderr,
+        "Usage: %s [options] <capture.pcap | /dev/usbmonN>\n"
+        "  -v vid:pid  Device to report on, learned from its device descriptor (default %04x:%04x)\n"
+        "  -d bus:dev  Report on this bus and device address instead\n"
+        "  -t ms       Control and bulk transfers slower than this are listed as NAK heavy (default 2)\n"
+        "  -n count    Interrupt OUT transfers pending for more polling intervals than this are listed (default 4)\n"
+        "  -i ms       Polling interval to assume when the capture doesn't record it (default 32)\n"
+        "  -c count    Stop after this many usbmon events\n",
+        argv[0], VENDOR_ID, PRODUCT_ID);
+    return 1;
+}
+
+static uint16_t swap16(uint16_t v) { return (v >> 8) | (v << 8); }
+static uint32_t swap32(uint32_t v) { return __builtin_bswap32(v); }
+static uint64_t swap64(uint64_t v) { return __builtin_bswap64(v); }
+
+// Check the pcap global header. pcapng files are not supported,
+// convert them with `editcap -F pcap` first.
+static bool openPcap(FILE *f, int *linkType, bool *swapped) {
+    uint32_t header[6];
+
+    if(fread(header, sizeof(header), 1, f) != 1) {
+        fprintf(stderr, "Capture file is too short\n");
+        return false;
+    }
+
+    switch(header[0]) {
+        case 0xa1b2c3d4:    // Microseconds
+        case 0xa1b23c4d:    // Nanoseconds, the usbmon header has its own microsecond timestamp
+            *swapped = false;
+            break;
+        case 0xd4c3b2a1:
+        case 0x4d3cb2a1:
+            *swapped = true;
+            break;
+        default:
+            fprintf(stderr, "Not a pcap file (pcapng needs converting with editcap -F pcap)\n");
+            return false;
+    }
+
+    *linkType = (*swapped ? swap32(header[5]) : header[5]) & 0xFFFF;
+    if((*linkType != DLT_USB_LINUX) && (*linkType != DLT_USB_LINUX_MMAPPED)) {
+        fprintf(stderr, "Capture is not of a Linux usbmon interface (link type %d)\n", *linkType);
+        return false;
+    }
+
+    return true;
+}
+
+static bool readPcap(FILE *f, bool swapped, int linkType, usbmon_packet_t *hdr, uint8_t *data, uint32_t *dataLen) {
+    uint32_t record[4];
+    static uint8_t packet[65536 + sizeof(usbmon_packet_t)];
+    uint32_t hdrLen = (linkType == DLT_USB_LINUX_MMAPPED) ? 64 : 48;
+
+    while(fread(record, sizeof(record), 1, f) == 1) {
+        uint32_t capLen = swapped ? swap32(record[2]) : record[2];
+
+        if(capLen > sizeof(packet)) {
+            fprintf(stderr, "Capture record too large, stopping\n");
+            return false;
+        }
+        if(fread(packet, capLen, 1, f) != 1) {
+            return false;
+        }
+        // Skip anything too short to be a usbmon event
+        if(capLen < hdrLen) {
+            continue;
+        }
+
+        memset(hdr, 0, sizeof(*hdr));
+        memcpy(hdr, packet, hdrLen);
+
+        // The header is in the byte order of the machine that captured it
+        if(swapped) {
+            hdr->id = swap64(hdr->id);
+            hdr->busnum = swap16(hdr->busnum);
+            hdr->ts_sec = swap64(hdr->ts_sec);
+            hdr->ts_usec = swap32(hdr->ts_usec);
+            hdr->status = swap32(hdr->status);
+            hdr->length = swap32(hdr->length);
+            hdr->len_cap = swap32(hdr->len_cap);
+            hdr->interval = swap32(hdr->interval);
+            hdr->ndesc = swap32(hdr->ndesc);
+        }
+
+        // ISO descriptors sit between the header and the data
+        uint32_t offset = hdrLen;
+        if((linkType == DLT_USB_LINUX_MMAPPED) && (hdr->xfer_type == XFER_ISO)) {
+            offset += hdr->ndesc * 16;
+        }
+
+        *dataLen = (capLen > offset) ? (capLen - offset) : 0;
+        memcpy(data, &packet[offset], *dataLen);
+        return true;
+    }
+
+    return false;
+}
+
+static void handleEvent(const usbmon_packet_t *hdr, const uint8_t *data, uint32_t dataLen) {
+    int64_t tsUs = (hdr->ts_sec * 1000000LL) + hdr->ts_usec;
+    int devIndex;
+
+    if(firstUs < 0) {
+        firstUs = tsUs;
+    }
+
+    device_t *dev = findDevice(hdr->busnum, hdr->devnum, &devIndex);
+    if(dev == NULL) {
+        return;
+    }
+
+    if(hdr->type == 'S') {
+        if(numPending >= MAX_PENDING) {
+            return;
+        }
+        pending_t *p = &pending[numPending++];
+        p->id = hdr->id;
+        p->tsUs = tsUs;
+        p->device = devIndex;
+        p->stream = findStream(dev, hdr);
+        // GET_DESCRIPTOR(Device) reply holds the VID/PID at offset 8
+        p->descriptorRead = (hdr->xfer_type == XFER_CONTROL) && (hdr->flag_setup == 0) &&
+                            (hdr->setup[0] == 0x80) && (hdr->setup[1] == 0x06) && (hdr->setup[3] == 0x01);
+        return;
+    }
+
+    // A completion ('C') or a failed submission ('E'), find its submission
+    int i;
+    for(i = 0; i < numPending; i++) {
+        if((pending[i].id == hdr->id) && (pending[i].device == devIndex)) {
+            break;
+        }
+    }
+    if(i == numPending) {
+        // Submitted before the capture started
+        return;
+    }
+
+    pending_t p = pending[i];
+    pending[i] = pending[--numPending];
+
+    if(p.stream < 0) {
+        return;
+    }
+
+    stream_t *stream = &dev->streams[p.stream];
+    uint64_t us = (tsUs > p.tsUs) ? (tsUs - p.tsUs) : 0;
+    double ts = (p.tsUs - firstUs) / 1e6;
+
+    if(p.descriptorRead && (hdr->status == 0) && (dataLen >= 12) && (hdr->devnum != 0)) {
+        dev->vid = data[8] | (data[9] << 8);
+        dev->pid = data[10] | (data[11] << 8);
+        dev->identified = true;
+    }
+
+    if(hdr->type == 'E') {
+        stream->errors++;
+        return;
+    }
+
+    if(hdr->status == EPIPE_STATUS) {
+        stream->stalls++;
+        if(dev->numStalls < MAX_EVENTS) {
+            dev->stalls[dev->numStalls++] = (event_t){ts, us, p.stream};
+        }
+    }
+    else if(hdr->status != 0) {
+        // Cancelled, disconnected, timed out and so on. Not a latency sample.
+        stream->errors++;
+        return;
+    }
+
+    stream->count++;
+    stream->totalUs += us;
+    if((stream->count == 1) || (us < stream->minUs)) stream->minUs = us;
+    if(us > stream->maxUs) stream->maxUs = us;
+
+    int bin = 0;
+    while((bin < (HIST_BINS - 1)) && (us >= (2ULL << bin))) {
+        bin++;
+    }
+    stream->hist[bin]++;
+
+    // A STALL is the device's answer, however long it took. It is already
+    // counted and listed above, don't count it as NAK heavy too.
+    if(hdr->status == EPIPE_STATUS) {
+        return;
+    }
+
+    // An interrupt IN transfer stays pending until the device has something to
+    // send. Ours only reports button changes, so that is idle polling, not NAKs
+    // worth listing.
+    if((stream->xfer_type == XFER_INTERRUPT) && (stream->epnum & 0x80)) {
+        return;
+    }
+
+    // usbmon doesn't see NAKs, but a transfer that takes much longer than the bus
+    // needs was NAKed until the device was ready. For interrupt transfers that is
+    // measured in polling intervals, which the mmapped header records.
+    uint64_t slowUs = slowCtrlUs;
+    if(stream->xfer_type == XFER_INTERRUPT) {
+        uint32_t intervalMs = (hdr->interval > 0) ? (uint32_t)hdr->interval : defaultIntervalMs;
+        slowUs = (uint64_t)intervalMs * 1000 * slowIntervals;
+    }
+    if(us > slowUs) {
+        stream->slow++;
+        addSlow(dev, ts, us, p.stream);
+    }
+}
+
+static device_t *findDevice(uint16_t busnum, uint8_t devnum, int *index) {
+    for(int i = 0; i < numDevices; i++) {
+        if((devices[i].busnum == busnum) && (devices[i].devnum == devnum)) {
+            *index = i;
+            return &devices[i];
+        }
+    }
+
+    if(numDevices >= MAX_DEVICES) {
+        return NULL;
+    }
+
+    *index = numDevices;
+    device_t *dev = &devices[numDevices++];
+    memset(dev, 0, sizeof(*dev));
+    dev->busnum = busnum;
+    dev->devnum = devnum;
+    return dev;
+}
+
+// Transfers are grouped by type and endpoint, and vendor control
+// requests by bRequest so each of them gets its own histogram
+static int findStream(device_t *dev, const usbmon_packet_t *hdr) {
+    int16_t request = -1;
+    uint8_t epnum = hdr->epnum;
+
+    if(hdr->xfer_type == XFER_CONTROL) {
+        // Both directions of the control endpoint are one stream
+        epnum &= 0x7F;
+        if((hdr->flag_setup == 0) && ((hdr->setup[0] & 0x60) == 0x40)) {
+            request = hdr->setup[1];
+        }
+    }
+
+    for(int i = 0; i < dev->numStreams; i++) {
+        stream_t *s = &dev->streams[i];
+        if((s->xfer_type == hdr->xfer_type) && (s->epnum == epnum) && (s->request == request)) {
+            return i;
+        }
+    }
+
+    if(dev->numStreams >= MAX_STREAMS) {
+        return -1;
+    }
+
+    stream_t *s = &dev->streams[dev->numStreams];
+    memset(s, 0, sizeof(*s));
+    s->xfer_type = hdr->xfer_type;
+    s->epnum = epnum;
+    s->request = request;
+    return dev->numStreams++;
+}
+
+static void addSlow(device_t *dev, double ts, uint64_t us, int stream) {
+    int i = dev->numSlow;
+
+    if(i == MAX_EVENTS) {
+        if(us <= dev->slow[MAX_EVENTS - 1].us) {
+            return;
+        }
+        i--;
+    }
+    else {
+        dev->numSlow++;
+    }
+
+    // Insert keeping the longest first
+    while((i > 0) && (dev->slow[i - 1].us < us)) {
+        dev->slow[i] = dev->slow[i - 1];
+        i--;
+    }
+    dev->slow[i] = (event_t){ts, us, stream};
+}
+
+static const char *streamName(const stream_t *stream, char *buff, size_t len) {
+    static const char *types[] = {"iso", "interrupt", "control", "bulk"};
+    const char *dir = (stream->epnum & 0x80) ? "IN" : "OUT";
+
+    if(stream->xfer_type == XFER_CONTROL) {
+        if(stream->request == VENDOR_REQ_WRITE_VAR) {
+            snprintf(buff, len, "vendor 0x01 (write var)");
+        }
+        else if(stream->request == VENDOR_REQ_READ_VAR) {
+            snprintf(buff, len, "vendor 0x02 (read var)");
+        }
+        else if(stream->request >= 0) {
+            snprintf(buff, len, "vendor 0x%02x", stream->request);
+        }
+        else {
+            snprintf(buff, len, "control");
+        }
+    }
+    else {
+        snprintf(buff, len, "%s %s 0x%02x", types[stream->xfer_type & 0x03], dir, stream->epnum);
+    }
+
+    return buff;
+}
+
+static void printReport(void) {
+    char name[32];
+    int shown = 0;
+
+    for(int d = 0; d < numDevices; d++) {
+        device_t *dev = &devices[d];
+
+        if(matchBus >= 0) {
+            if((dev->busnum != matchBus) || (dev->devnum != matchDev)) continue;
+        }
+        else if(!dev->identified || (dev->vid != matchVid) || (dev->pid != matchPid)) {
+            continue;
+        }
+
+        shown++;
+        printf("\nDevice %u:%u", dev->busnum, dev->devnum);
+        if(dev->identified) {
+            printf(" (%04x:%04x)", dev->vid, dev->pid);
+        }
+        printf("\n\n  %-24s %8s %7s %7s %7s %10s %10s %10s\n",
+            "transfer", "count", "stalls", "slow", "errors", "min us", "avg us", "max us");
+
+        for(int s = 0; s < dev->numStreams; s++) {
+            stream_t *stream = &dev->streams[s];
+            printf("  %-24s %8u %7u %7u %7u %10llu %10.0f %10llu\n",
+                streamName(stream, name, sizeof(name)), stream->count, stream->stalls, stream->slow, stream->errors,
+                (unsigned long long)stream->minUs,
+                stream->count ? ((double)stream->totalUs / stream->count) : 0.0,
+                (unsigned long long)stream->maxUs);
+        }
+
+        // Submit to complete latency histograms
+        for(int s = 0; s < dev->numStreams; s++) {
+            stream_t *stream = &dev->streams[s];
+            uint32_t peak = 0;
+
+            if(stream->count == 0) continue;
+
+            for(int b = 0; b < HIST_BINS; b++) {
+                if(stream->hist[b] > peak) peak = stream->hist[b];
+            }
+
+            printf("\n  %s latency\n", streamName(stream, name, sizeof(name)));
+            for(int b = 0; b < HIST_BINS; b++) {
+                if(stream->hist[b] == 0) continue;
+                int bar = (stream->hist[b] * 40 + peak - 1) / peak;
+                printf("    %8llu - %-8llu us %8u  %.*s\n",
+                    b ? (1ULL << b) : 0ULL, (2ULL << b) - 1, stream->hist[b],
+                    bar, "########################################");
+            }
+        }
+
+        if(dev->numStalls) {
+            printf("\n  STALLs (first %d)\n", MAX_EVENTS);
+            for(int i = 0; i < dev->numStalls; i++) {
+                printf("    %12.6fs  %-24s after %llu us\n", dev->stalls[i].ts,
+                    streamName(&dev->streams[dev->stalls[i].stream], name, sizeof(name)),
+                    (unsigned long long)dev->stalls[i].us);
+            }
+        }
+
+        if(dev->numSlow) {
+            printf("\n  NAK heavy transfers (longest %d)\n", MAX_EVENTS);
+            for(int i = 0; i < dev->numSlow; i++) {
+                printf("    %12.6fs  %-24s pending %llu us\n", dev->slow[i].ts,
+                    streamName(&dev->streams[dev->slow[i].stream], name, sizeof(name)),
+                    (unsigned long long)dev->slow[i].us);
+            }
+        }
+    }
+
+    if(!shown) {
+        printf("No matching device in the capture. Its device descriptor must be captured to\n"
+               "match by VID/PID, otherwise pass -d bus:dev.\n");
+    }
+}
@@ -0,0 +1,340 @@
+var usb = require('usb');
+var { Readable } = require('stream');
+
+var VID = 0xDEAD
+var PID = 0xBEEF
+
+var INT_IN_EP = 0x81;       // Interrupt IN endpoint address (EP 1, IN direction)
+var INT_IN_EP_SIZE = 64;    // wMaxPacketSize of the interrupt IN endpoint
+
+// Report format, see src/protocol.h
+var PROTOCOL_VERSION = 1;
+var PROTOCOL_HEADER_SIZE = 8;
+var PROTOCOL_SAMPLE_STATE_BITS = 3;
+var PROTOCOL_SAMPLE_DELTA_US = 8;
+var POLL_TRANSFERS = 3;     // Number of transfers kept outstanding while polling
+
+var VENDOR_OUT = 0x40;      // bmRequestType for a vendor Control Write (host to device)
+var VENDOR_IN = 0xC0;       // bmRequestType for a vendor Control Read (device to host)
+
+var REQ_REGISTRY_READ = 0x03;   // Batched variable read, wIndex:wValue is the id mask
+var REQ_REGISTRY_WRITE = 0x04;  // Batched variable write, wIndex:wValue is the id mask
+var REQ_REGISTRY_INFO = 0x05;   // Returns the largest batch, then (id, size, access) for every variable
+var REGISTRY_INFO_MAX = 2 + (32 * 3);   // Largest REGISTRY_INFO reply, 32 ids at most
+
+var REQ_LED_PATTERN = 0x0B;     // Uploads an LED pattern, wValue is the repeat count (0 forever)
+var LED_STEP_FADE = 0x01;       // Ramp to the step's brightness instead of jumping to it
+var LED_MAX_STEPS = 16;
+
+var MAX_HALT_RECOVERIES = 3;    // Consecutive halts cleared before giving up on the endpoint
+
+// Wraps our device as an object-mode Readable stream. Every chunk is one
+// interrupt IN report (a Buffer). The interrupt endpoint is polled with
+// several transfers in flight so no poll interval is missed, and polling is
+// stopped whenever the consumer stops reading so memory use stays bounded.
+class Device extends Readable {
+    constructor(dev, options = {}) {
+        super({ objectMode: true, highWaterMark: options.highWaterMark || 16 });
+
+        this.dev = dev;
+        this.nTransfers = options.nTransfers || POLL_TRANSFERS;
+        this.polling = false;
+        this.stopping = false;
+        // Tail of our control transfer queue. Each transfer is chained onto it
+        // so only one is ever in flight and they complete in the order issued.
+        this.ctrlQueue = Promise.resolve();
+        this.registry = null;
+        this.maxXfer = 0;
+        this.halts = 0;
+        this.haltsCleared = 0;
+        this.recovering = false;
+
+        this.dev.open();
+        this.iface = this.dev.interface(0);
+        this.iface.claim();
+        this.endpoint = this.iface.endpoint(INT_IN_EP);
+
+        this.endpoint.on('data', (data) => {
+            // Hand the report to the consumer. If they are not keeping up, stop
+            // polling until they ask for more. Transfers already in flight will
+            // still complete and are buffered by the stream.
+            this.halts = 0;
+            if(!this.push(data)) {
+                this._stopPoll();
+            }
+        });
+
+        this.endpoint.on('error', (err) => {
+            if(isStall(err) && (this.halts < MAX_HALT_RECOVERIES)) {
+                this._recoverHalt();
+            }
+            else {
+                this.destroy(err);
+            }
+        });
+    }
+
+    // Called by the stream whenever the consumer wants more data
+    _read() {
+        this._startPoll();
+    }
+
+    _startPoll() {
+        if(this.polling || this.stopping || this.recovering) {
+            return;
+        }
+
+        this.polling = true;
+        this.endpoint.startPoll(this.nTransfers, INT_IN_EP_SIZE);
+    }
+
+    _stopPoll() {
+        if(!this.polling || this.stopping) {
+            return;
+        }
+
+        this.stopping = true;
+        this.endpoint.stopPoll(() => {
+            this.polling = false;
+            this.stopping = false;
+
+            // The consumer may have drained the buffer while we were stopping,
+            // in which case the stream will not call _read() again on its own
+            if(!this.destroyed && this.readableLength < this.readableHighWaterMark) {
+                this._startPoll();
+            }
+        });
+    }
+
+    // The endpoint stalled. Stop polling, clear the halt (which also resets the
+    // data toggle) and carry on, rather than resetting the whole device.
+    _recoverHalt() {
+        if(this.recovering) {
+            return;
+        }
+
+        this.recovering = true;
+        this.halts++;
+
+        var clear = () => {
+            this.polling = false;
+            this.stopping = false;
+            // CLEAR_FEATURE is a control transfer, queue it behind ours
+            this._queueControl((done) => this.endpoint.clearHalt(done)).then(() => {
+                this.recovering = false;
+                this.haltsCleared++;
+                if(!this.destroyed && this.readableLength < this.readableHighWaterMark) {
+                    this._startPoll();
+                }
+            }, (err) => {
+                this.recovering = false;
+                this.destroy(err);
+            });
+        };
+
+        if(this.polling && !this.stopping) {
+            this.stopping = true;
+            this.endpoint.stopPoll(clear);
+        }
+        else if(this.stopping) {
+            // A stop is already in progress, clear once it has finished
+            this.endpoint.once('end', clear);
+        }
+        else {
+            clear();
+        }
+    }
+
+    // Replace the LED pattern in one control transfer. steps is an array of
+    // { brightness, duration, fade } with brightness 0-255 and duration in 1.024ms
+    // periods. The pattern plays repeat times, or forever if repeat is 0.
+    setLedPattern(steps, repeat = 0) {
+        if(steps.length > LED_MAX_STEPS) {
+            return Promise.reject(new Error('At most ' + LED_MAX_STEPS + ' steps'));
+        }
+
+        var data = Buffer.alloc(steps.length * 4);
+        steps.forEach((step, i) => {
+            data.writeUInt8(step.brightness, i * 4);
+            data.writeUInt8(step.fade ? LED_STEP_FADE : 0, (i * 4) + 1);
+            data.writeUInt16LE(step.duration, (i * 4) + 2);
+        });
+
+        return this.controlWrite(REQ_LED_PATTERN, repeat, 0, data);
+    }
+
+    // Clear a halt on one of our endpoints. Resolves once the device has acknowledged it.
+    // It goes through the control transfer queue like any other request.
+    clearHalt(address) {
+        var endpoint = this.iface.endpoint(address);
+        return this._queueControl((done) => endpoint.clearHalt(done));
+    }
+
+    _destroy(err, cb) {
+        // Stop polling entirely before releasing the interface
+        var close = () => {
+            this.iface.release(true, () => {
+                this.dev.close();
+                cb(err);
+            });
+        };
+
+        if(this.polling && !this.stopping) {
+            this.stopping = true;
+            this.endpoint.stopPoll(close);
+        }
+        else {
+            close();
+        }
+    }
+
+    // Queue a control transfer behind any that are still outstanding. start(done)
+    // issues it and calls done(err, data) once it completes.
+    _queueControl(start) {
+        var transfer = this.ctrlQueue.then(() => new Promise((resolve, reject) => {
+            start((err, data) => {
+                if(err) {
+                    reject(err);
+                }
+                else {
+                    resolve(data);
+                }
+            });
+        }));
+
+        // A failed transfer must not stall the transfers queued behind it
+        this.ctrlQueue = transfer.catch(() => {});
+
+        return transfer;
+    }
+
+    _controlTransfer(bmRequestType, bRequest, wValue, wIndex, dataOrLength) {
+        return this._queueControl((done) => {
+            this.dev.controlTransfer(bmRequestType, bRequest, wValue, wIndex, dataOrLength, done);
+        });
+    }
+
+    // Send a vendor Control Write. Resolves once the device has acknowledged it.
+    controlWrite(request, value = 0x0000, index = 0x0000, data = Buffer.alloc(0)) {
+        return this._controlTransfer(VENDOR_OUT, request, value, index, data);
+    }
+
+    // Send a vendor Control Read. Resolves with the Buffer returned by the device.
+    controlRead(request, length, value = 0x0000, index = 0x0000) {
+        return this._controlTransfer(VENDOR_IN, request, value, index, length);
+    }
+
+    // Resolves with a Map of id => { size, access } for every variable the device exposes
+    getRegistry() {
+        if(!this.registry) {
+            this.registry = this.controlRead(REQ_REGISTRY_INFO, REGISTRY_INFO_MAX).then((info) => {
+                if(info.length < 2) {
+                    throw new Error('Short registry description');
+                }
+                // The largest batch the firmware can buffer comes first
+                this.maxXfer = info.readUInt16LE(0);
+                var registry = new Map();
+                for(var i = 2; (i + 2) < info.length; i += 3) {
+                    registry.set(info[i], { size: info[i + 1], access: info[i + 2] });
+                }
+                return registry;
+            });
+            // Allow a retry if the description could not be read
+            this.registry.catch(() => { this.registry = null; });
+        }
+
+        return this.registry;
+    }
+
+    // Packed size of a batch of ids, throws if the firmware can't buffer it
+    _batchSize(registry, ids) {
+        var length = ids.reduce((len, id) => len + registry.get(id).size, 0);
+        if(length > this.maxXfer) {
+            throw new Error('Batch of ' + length + ' bytes is larger than the device\'s ' + this.maxXfer + ' byte limit');
+        }
+        return length;
+    }
+
+    // Read several variables in one control transfer. Resolves with a Map of id => value.
+    async getVars(ids) {
+        var registry = await this.getRegistry();
+        ids = [...new Set(ids)].sort((a, b) => a - b);
+        var mask = idMask(ids);
+        var length = this._batchSize(registry, ids);
+
+        var data = await this.controlRead(REQ_REGISTRY_READ, length, mask & 0xFFFF, mask >>> 16);
+        if(data.length !== length) {
+            throw new Error('Expected ' + length + ' bytes of values, got ' + data.length);
+        }
+
+        // Values come back packed in ascending id order
+        var values = new Map();
+        var offset = 0;
+        for(var id of ids) {
+            var size = registry.get(id).size;
+            values.set(id, data.readUIntLE(offset, size));
+            offset += size;
+        }
+        return values;
+    }
+
+    // Write several variables, given as an object or Map of id => value, in one control transfer
+    async setVars(values) {
+        var registry = await this.getRegistry();
+        var entries = (values instanceof Map ? [...values] : Object.entries(values))
+            .map(([id, value]) => [Number(id), value])
+            .sort((a, b) => a[0] - b[0]);
+        var mask = idMask(entries.map(([id]) => id));
+        this._batchSize(registry, entries.map(([id]) => id));
+
+        var data = Buffer.concat(entries.map(([id, value]) => {
+            var size = registry.get(id).size;
+            var buff = Buffer.alloc(size);
+            buff.writeUIntLE(value, 0, size);
+            return buff;
+        }));
+
+        await this.controlWrite(REQ_REGISTRY_WRITE, mask & 0xFFFF, mask >>> 16, data);
+    }
+}
+
+// Decode an interrupt IN report into { dropped, samples } where samples is an
+// array of { time, state } in the order the changes happened, time being the
+// device clock in microseconds.
+function decodeReport(report) {
+    if(report.length < PROTOCOL_HEADER_SIZE || report[0] !== PROTOCOL_VERSION) {
+        throw new Error('Unknown report format');
+    }
+
+    var count = report[1];
+    var time = report.readUInt32LE(4);
+    var samples = [];
+    for(var i = 0; i < count; i++) {
+        var sample = report.readUInt16LE(PROTOCOL_HEADER_SIZE + (i * 2));
+        time = (time + ((sample >>> PROTOCOL_SAMPLE_STATE_BITS) * PROTOCOL_SAMPLE_DELTA_US)) >>> 0;
+        samples.push({ time: time, state: sample & ((1 << PROTOCOL_SAMPLE_STATE_BITS) - 1) });
+    }
+
+    return { dropped: report[2], samples: samples };
+}
+
+function isStall(err) {
+    return (err.errno === usb.LIBUSB_TRANSFER_STALL) || (err.errno === usb.LIBUSB_ERROR_PIPE);
+}
+
+function idMask(ids) {
+    return ids.reduce((mask, id) => (mask | (1 << id)) >>> 0, 0);
+}
+
+// Find and open our device
+function open(vid = VID, pid = PID, options = {}) {
+    var dev = usb.findByIds(vid, pid);
+
+    if(!dev) {
+        throw new Error('Could not find device');
+    }
+
+    return new Device(dev, options);
+}
+
+module.exports = { Device, open, decodeReport };
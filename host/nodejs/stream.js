@@ -0,0 +1,36 @@
+var device = require('./device');
+
+var led_state = 0;
+
+// Find our device and open it as a stream of interrupt reports
+var dev = device.open();
+
+// Print every button change as its report arrives
+dev.on('data', (report) => {
+    var { dropped, samples } = device.decodeReport(report);
+    for(var sample of samples) {
+        console.log(`[${sample.time} us] Buttons: ${sample.state.toString(2).padStart(3, '0')}`);
+    }
+    if(dropped) {
+        console.log(`Device dropped ${dropped} changes`);
+    }
+});
+
+dev.on('error', (err) => {
+    console.log(err);
+});
+
+// Read our variable once via a Control Read
+dev.controlRead(0x02, 1).then((buff) => {
+    console.log(`Value: ${buff[0]}`);
+}).catch((err) => {
+    console.log(err);
+});
+
+// Toggle the LED state via a control transfer every half second
+setInterval(() => {
+    led_state = led_state ? 0 : 1;
+    dev.controlWrite(0x01, led_state).catch((err) => {
+        console.log(err);
+    });
+}, 500);
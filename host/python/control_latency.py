@@ -0,0 +1,98 @@
+"""Measures how long bulk commands wait while slow control requests run.
+
+The vendor 0x02 callback is slowed down with control_delay_ms (registry
+variable 12) and run once with it calling work_yield() every millisecond,
+then once without (control_delay_yield, variable 16). Meanwhile a thread
+keeps a NOP command going round the bulk endpoints. The worst wait for the
+bulk worker (variable 14) only stays small while the callback yields.
+"""
+import struct
+import sys
+import threading
+import time
+import usb.core
+
+# Registry variables, see src/main.c
+VAR_ID_CONTROL_DELAY_MS = 12
+VAR_ID_BULK_MAX_LATENCY_US = 14
+VAR_ID_CONTROL_MAX_RUN_US = 15
+VAR_ID_CONTROL_DELAY_YIELD = 16
+
+REQ_READ_VAR = 0x02
+REQ_REGISTRY_READ = 0x03
+REQ_REGISTRY_WRITE = 0x04
+
+BULK_OUT_EP = 0x02
+BULK_IN_EP = 0x83
+CMD_OP_NOP = 0x00
+
+DELAY_MS = 50       # How long each control request takes
+REQUESTS = 10       # Control requests per run
+
+
+def id_mask(ids):
+    mask = 0
+    for i in ids:
+        mask |= (1 << i)
+    return mask
+
+
+def set_vars(dev, values):
+    # Values go out packed in ascending id order, values is {id: (format, value)}
+    ids = sorted(values)
+    mask = id_mask(ids)
+    data = b"".join(struct.pack(values[i][0], values[i][1]) for i in ids)
+    dev.ctrl_transfer(0x40, REQ_REGISTRY_WRITE, mask & 0xFFFF, mask >> 16, data)
+
+
+def get_u16s(dev, ids):
+    ids = sorted(ids)
+    mask = id_mask(ids)
+    data = dev.ctrl_transfer(0xC0, REQ_REGISTRY_READ, mask & 0xFFFF, mask >> 16, 2 * len(ids))
+    return dict(zip(ids, struct.unpack("<%dH" % len(ids), bytes(data))))
+
+
+def ping(dev, stop, worst):
+    # One NOP in flight at a time, timed from the write to its completion
+    seq = 0
+    while not stop.is_set():
+        start = time.monotonic()
+        dev.write(BULK_OUT_EP, bytes([seq, CMD_OP_NOP, 0]))
+        dev.read(BULK_IN_EP, 64, timeout=1000)
+        worst[0] = max(worst[0], time.monotonic() - start)
+        seq = (seq + 1) & 0xFF
+
+
+def measure(dev, yields):
+    set_vars(dev, {VAR_ID_CONTROL_DELAY_MS: ("<H", DELAY_MS),
+                   VAR_ID_CONTROL_DELAY_YIELD: ("<B", 1 if yields else 0),
+                   VAR_ID_BULK_MAX_LATENCY_US: ("<H", 0),
+                   VAR_ID_CONTROL_MAX_RUN_US: ("<H", 0)})
+
+    stop = threading.Event()
+    worst = [0.0]
+    pinger = threading.Thread(target=ping, args=(dev, stop, worst))
+    pinger.start()
+
+    for i in range(REQUESTS):
+        dev.ctrl_transfer(0xC0, REQ_READ_VAR, 0x0000, 0x0000, 1)
+
+    stop.set()
+    pinger.join()
+
+    stats = get_u16s(dev, [VAR_ID_BULK_MAX_LATENCY_US, VAR_ID_CONTROL_MAX_RUN_US])
+    print("%-14s control request %6d us, bulk worker waited up to %6d us, bulk round trip up to %6.0f us" %
+          ("yielding:" if yields else "not yielding:", stats[VAR_ID_CONTROL_MAX_RUN_US],
+           stats[VAR_ID_BULK_MAX_LATENCY_US], worst[0] * 1e6))
+
+
+dev = usb.core.find(idVendor=0xdead, idProduct=0xbeef)
+if(dev == None):
+    print("Could not find device")
+    sys.exit(255)
+
+try:
+    measure(dev, True)
+    measure(dev, False)
+finally:
+    set_vars(dev, {VAR_ID_CONTROL_DELAY_MS: ("<H", 0), VAR_ID_CONTROL_DELAY_YIELD: ("<B", 1)})
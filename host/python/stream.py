@@ -0,0 +1,41 @@
+import asyncio
+import sys
+
+from usb_async import AsyncDevice, decode_report
+
+
+async def flash_led(dev):
+    led_state = 0
+    while(1):
+        # Toggle the LED via a Control Write without blocking the report reader
+        led_state = 0 if led_state else 1
+        await dev.control_write(0x01, led_state)
+        await asyncio.sleep(0.5)
+
+
+async def main():
+    try:
+        dev = await AsyncDevice.open()
+    except IOError as e:
+        print(e)
+        sys.exit(255)
+
+    async with dev:
+        # Read our variable once via a Control Read
+        value = await dev.control_read(0x02, 1)
+        print("Value: " + str(value[0]))
+
+        flasher = asyncio.create_task(flash_led(dev))
+
+        # Print every button change as its report arrives
+        async for report in dev.reports():
+            dropped, samples = decode_report(report)
+            for time, state in samples:
+                print("[" + str(time) + " us] Buttons: " + format(state, "03b"))
+            if dropped or dev.dropped:
+                print("Dropped " + str(dropped) + " on the device, " + str(dev.dropped) + " on the host")
+
+        flasher.cancel()
+
+
+asyncio.run(main())
@@ -0,0 +1,347 @@
+import asyncio
+import concurrent.futures
+import errno
+import queue
+import threading
+
+import usb.core
+import usb.util
+
+VENDOR_ID = 0xdead
+PRODUCT_ID = 0xbeef
+
+INT_IN_EP = 0x81        # Interrupt IN endpoint address (EP 1, IN direction)
+INT_IN_EP_SIZE = 64     # wMaxPacketSize of the interrupt IN endpoint
+
+# Report format, see src/protocol.h
+PROTOCOL_VERSION = 1
+PROTOCOL_HEADER_SIZE = 8
+PROTOCOL_SAMPLE_STATE_BITS = 3
+PROTOCOL_SAMPLE_DELTA_US = 8
+
+VENDOR_OUT = 0x40       # bmRequestType for a vendor Control Write (host to device)
+VENDOR_IN = 0xC0        # bmRequestType for a vendor Control Read (device to host)
+
+REQ_REGISTRY_READ = 0x03    # Batched variable read, wIndex:wValue is the id mask
+REQ_REGISTRY_WRITE = 0x04   # Batched variable write, wIndex:wValue is the id mask
+REQ_REGISTRY_INFO = 0x05    # Returns the largest batch, then (id, size, access) for every variable
+REGISTRY_READ = 0x01
+REGISTRY_WRITE = 0x02
+REGISTRY_INFO_MAX = 2 + (32 * 3)    # Largest REGISTRY_INFO reply, 32 ids at most
+
+REQ_LED_PATTERN = 0x0B     # Uploads an LED pattern, wValue is the repeat count (0 forever)
+LED_STEP_FADE = 0x01        # Ramp to the step's brightness instead of jumping to it
+LED_MAX_STEPS = 16
+
+MAX_HALT_RECOVERIES = 3     # Consecutive halts cleared before giving up on the endpoint
+
+
+class DeviceClosedError(IOError):
+    """Raised for transfers that were still queued when the device was closed."""
+
+
+class AsyncDevice:
+    """asyncio wrapper around a pyusb device.
+
+    pyusb (and libusb underneath it) only offers blocking calls, so every
+    transfer is run on a dedicated I/O thread and its result is handed back
+    to the event loop. Control transfers are executed one at a time, in the
+    order they were awaited. Interrupt IN reports are read continuously on a
+    second thread and buffered in a bounded queue; when the consumer falls
+    behind the oldest report is dropped and counted in `dropped`.
+
+    If the interrupt endpoint stalls, the halt is cleared with a single
+    CLEAR_FEATURE request and reading resumes; recoveries are counted in
+    `halts_cleared`. That request is queued on the I/O thread like any
+    other control transfer.
+    """
+
+    def __init__(self, dev, loop=None, report_queue_len=64, poll_timeout=100):
+        self._dev = dev
+        self._loop = loop or asyncio.get_running_loop()
+        self._jobs = queue.Queue()
+        self._reports = asyncio.Queue(maxsize=report_queue_len)
+        self._poll_timeout = poll_timeout
+        self._running = True
+        self._reader = None
+        self._registry = None
+        self._max_xfer = 0
+        self.dropped = 0
+        self.halts_cleared = 0
+
+        # All control transfers go through this one thread so they never
+        # block the event loop and never run concurrently with each other
+        self._io_thread = threading.Thread(target=self._io_worker, daemon=True)
+        self._io_thread.start()
+
+    @classmethod
+    async def open(cls, vid=VENDOR_ID, pid=PRODUCT_ID, **kwargs):
+        dev = usb.core.find(idVendor=vid, idProduct=pid)
+        if dev is None:
+            raise IOError("Could not find device")
+        return cls(dev, loop=asyncio.get_running_loop(), **kwargs)
+
+    async def control_write(self, request, value=0x0000, index=0x0000, data=None, timeout=1000):
+        """Issue a vendor Control Write and return the number of bytes sent."""
+        return await self._submit(self._dev.ctrl_transfer,
+                                  VENDOR_OUT, request, value, index,
+                                  data if data is not None else 0x0000, timeout)
+
+    async def control_read(self, request, length, value=0x0000, index=0x0000, timeout=1000):
+        """Issue a vendor Control Read and return the received bytes."""
+        data = await self._submit(self._dev.ctrl_transfer,
+                                  VENDOR_IN, request, value, index, length, timeout)
+        return bytes(data)
+
+    async def registry(self):
+        """Return {id: (size, access)} for every variable the device exposes."""
+        if self._registry is None:
+            info = await self.control_read(REQ_REGISTRY_INFO, REGISTRY_INFO_MAX)
+            if len(info) < 2:
+                raise IOError("Short registry description")
+            # The largest batch the firmware can buffer comes first
+            self._max_xfer = int.from_bytes(info[0:2], "little")
+            self._registry = {info[i]: (info[i + 1], info[i + 2])
+                              for i in range(2, len(info) - 2, 3)}
+        return self._registry
+
+    async def _batch_size(self, ids):
+        registry = await self.registry()
+        length = sum(registry[i][0] for i in ids)
+        if length > self._max_xfer:
+            raise ValueError("Batch of %d bytes is larger than the device's %d byte limit"
+                             % (length, self._max_xfer))
+        return length
+
+    async def get_vars(self, ids):
+        """Read several variables in one control transfer.
+
+        Returns {id: value} with each value decoded as an unsigned little
+        endian integer.
+        """
+        registry = await self.registry()
+        ids = sorted(set(ids))
+        mask = _id_mask(ids)
+        length = await self._batch_size(ids)
+
+        data = await self.control_read(REQ_REGISTRY_READ, length,
+                                       mask & 0xFFFF, mask >> 16)
+        if len(data) != length:
+            raise IOError("Expected %d bytes of values, got %d" % (length, len(data)))
+
+        # Values come back packed in ascending id order
+        values = {}
+        offset = 0
+        for i in ids:
+            size = registry[i][0]
+            values[i] = int.from_bytes(data[offset:offset + size], "little")
+            offset += size
+        return values
+
+    async def set_vars(self, values):
+        """Write several variables, given as {id: value}, in one control transfer."""
+        registry = await self.registry()
+        ids = sorted(values)
+        mask = _id_mask(ids)
+        await self._batch_size(ids)
+        data = b"".join(values[i].to_bytes(registry[i][0], "little") for i in ids)
+
+        await self.control_write(REQ_REGISTRY_WRITE, mask & 0xFFFF, mask >> 16, data)
+
+    async def set_led_pattern(self, steps, repeat=0):
+        """Replace the LED pattern in one control transfer.
+
+        steps is a list of (brightness, duration) or (brightness, duration, fade)
+        tuples. Brightness is 0-255 and duration is in 1.024 ms periods. The
+        pattern plays repeat times, or forever if repeat is 0.
+        """
+        if len(steps) > LED_MAX_STEPS:
+            raise ValueError("At most %d steps" % LED_MAX_STEPS)
+        data = b""
+        for brightness, duration, *fade in steps:
+            flags = LED_STEP_FADE if (fade and fade[0]) else 0
+            data += bytes([brightness, flags]) + duration.to_bytes(2, "little")
+        await self.control_write(REQ_LED_PATTERN, repeat, 0, data)
+
+    async def clear_halt(self, endpoint):
+        """Clear a halt on an endpoint, also resetting its data toggle."""
+        await self._submit(self._dev.clear_halt, endpoint)
+
+    def reports(self):
+        """Return an async iterator over the interrupt IN reports.
+
+        The first call starts the reader thread. Iterating never busy-waits;
+        the consumer is suspended until the next report arrives.
+        """
+        if self._reader is None:
+            self._reader = threading.Thread(target=self._report_worker, daemon=True)
+            self._reader.start()
+        return self._iter_reports()
+
+    async def close(self):
+        """Stop the I/O threads and release the device.
+
+        Transfers still waiting to be executed fail with DeviceClosedError.
+        """
+        self._running = False
+        self._fail_queued_jobs()
+        # Wake the I/O thread so it can exit
+        self._jobs.put(None)
+        await self._loop.run_in_executor(None, self._io_thread.join)
+        if self._reader is not None:
+            await self._loop.run_in_executor(None, self._reader.join)
+            # Let any pending iteration finish
+            self._push_report(None)
+        usb.util.dispose_resources(self._dev)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc):
+        await self.close()
+
+    async def _iter_reports(self):
+        while True:
+            report = await self._reports.get()
+            if report is None:
+                return
+            if isinstance(report, Exception):
+                raise report
+            yield report
+
+    def _submit(self, fn, *args):
+        future = self._loop.create_future()
+        if not self._running:
+            future.set_exception(DeviceClosedError("Device is closed"))
+        else:
+            self._jobs.put((future, fn, args))
+        return future
+
+    def _fail_queued_jobs(self):
+        # Fail every transfer that hasn't been started
+        while True:
+            try:
+                job = self._jobs.get_nowait()
+            except queue.Empty:
+                return
+            if job is not None:
+                self._resolve(job[0], exc=DeviceClosedError("Device is closed"))
+
+    def _io_worker(self):
+        while True:
+            job = self._jobs.get()
+            if job is None:
+                # Anything submitted while we were shutting down
+                self._fail_queued_jobs()
+                return
+
+            future, fn, args = job
+            try:
+                result = fn(*args)
+            except Exception as e:
+                self._resolve(future, exc=e)
+            else:
+                self._resolve(future, result)
+
+    def _submit_and_wait(self, fn, *args):
+        # _submit() for the reader thread, which has no event loop to await on
+        future = concurrent.futures.Future()
+        if not self._running:
+            raise DeviceClosedError("Device is closed")
+        self._jobs.put((future, fn, args))
+        while True:
+            try:
+                return future.result(timeout=self._poll_timeout / 1000)
+            except concurrent.futures.TimeoutError:
+                # A job queued as the I/O thread exits is never run
+                if not self._running:
+                    raise DeviceClosedError("Device is closed")
+
+    def _resolve(self, future, result=None, exc=None):
+        if isinstance(future, concurrent.futures.Future):
+            # Submitted by the reader thread, which is blocked on it
+            if exc is not None:
+                future.set_exception(exc)
+            else:
+                future.set_result(result)
+        elif exc is not None:
+            self._loop.call_soon_threadsafe(_set_exception, future, exc)
+        else:
+            self._loop.call_soon_threadsafe(_set_result, future, result)
+
+    def _report_worker(self):
+        halts = 0
+        while self._running:
+            try:
+                report = self._dev.read(INT_IN_EP, INT_IN_EP_SIZE, self._poll_timeout)
+            except usb.core.USBError as e:
+                # A timeout just means the device had nothing new for us
+                if e.errno == errno.ETIMEDOUT:
+                    continue
+                # The endpoint stalled. Clearing the halt is one control
+                # transfer and avoids a reset and re-enumeration. It goes
+                # through the I/O thread so it is never issued concurrently
+                # with another control transfer.
+                if e.errno == errno.EPIPE and halts < MAX_HALT_RECOVERIES:
+                    halts += 1
+                    try:
+                        self._submit_and_wait(self._dev.clear_halt, INT_IN_EP)
+                    except DeviceClosedError:
+                        return
+                    except usb.core.USBError as clear_err:
+                        e = clear_err
+                    else:
+                        self.halts_cleared += 1
+                        continue
+                # Hand the error to the consumer and stop reading
+                self._loop.call_soon_threadsafe(self._push_report, e)
+                return
+            halts = 0
+            self._loop.call_soon_threadsafe(self._push_report, bytes(report))
+
+    def _push_report(self, report):
+        # Runs on the event loop. Make room by discarding the oldest report
+        # so the consumer always sees the most recent state.
+        if self._reports.full():
+            self._reports.get_nowait()
+            self.dropped += 1
+        self._reports.put_nowait(report)
+
+
+def decode_report(report):
+    """Decode an interrupt IN report.
+
+    Returns (dropped, samples) where samples is a list of (device_us, state)
+    tuples in the order the changes happened and dropped is how many changes
+    the device could not fit in since the previous report.
+    """
+    if len(report) < PROTOCOL_HEADER_SIZE or report[0] != PROTOCOL_VERSION:
+        raise ValueError("Unknown report format")
+
+    count = report[1]
+    dropped = report[2]
+    time = int.from_bytes(report[4:8], "little")
+    samples = []
+    for i in range(count):
+        offset = PROTOCOL_HEADER_SIZE + (i * 2)
+        sample = int.from_bytes(report[offset:offset + 2], "little")
+        time = (time + ((sample >> PROTOCOL_SAMPLE_STATE_BITS) * PROTOCOL_SAMPLE_DELTA_US)) & 0xFFFFFFFF
+        samples.append((time, sample & ((1 << PROTOCOL_SAMPLE_STATE_BITS) - 1)))
+    return dropped, samples
+
+
+def _id_mask(ids):
+    mask = 0
+    for i in ids:
+        mask |= (1 << i)
+    return mask
+
+
+def _set_result(future, result):
+    if not future.cancelled():
+        future.set_result(result)
+
+
+def _set_exception(future, exc):
+    if not future.cancelled():
+        future.set_exception(exc)
@@ -0,0 +1,108 @@
+#include <stdbool.h>
+#include <string.h>
+#include "cmd.h"
+#include "usb.h"
+#include "registry.h"
+
+/*! @brief Completion waiting for room on the bulk IN endpoint */
+static uint8_t _completion[CMD_HEADER_SIZE + CMD_MAX_PAYLOAD] = {0x00};
+/*! @brief Length of the waiting completion, 0 if there is none */
+static uint8_t _completion_len = 0;
+
+static void _execute(const uint8_t seq, const uint8_t opcode, const uint8_t *payload, const uint8_t len);
+
+/*!
+ * @brief This API executes queued commands and queues their completions
+ */
+void cmd_task(void) {
+    uint8_t command[CMD_HEADER_SIZE + CMD_MAX_PAYLOAD];
+
+    while(1) {
+        // Don't execute anything else until the previous
+        // completion has made it into a bank
+        if(_completion_len) {
+            if(!usb_bulkWrite(_completion, _completion_len)) {
+                return;
+            }
+            _completion_len = 0;
+        }
+
+        // Wait for a whole command to be received
+        if(!usb_bulkPeek(command, CMD_HEADER_SIZE)) {
+            break;
+        }
+
+        if(command[2] > CMD_MAX_PAYLOAD) {
+            // The host broke the framing. Drop the header and report it.
+            usb_bulkRead(command, CMD_HEADER_SIZE);
+            _completion[0] = command[0];
+            _completion[1] = CMD_STATUS_BAD_LENGTH;
+            _completion[2] = 0;
+            _completion_len = CMD_HEADER_SIZE;
+            continue;
+        }
+
+        if(!usb_bulkRead(command, CMD_HEADER_SIZE + command[2])) {
+            break;
+        }
+
+        _execute(command[0], command[1], &command[CMD_HEADER_SIZE], command[2]);
+    }
+
+    // Nothing else is waiting so send whatever we have batched up, or
+    // the ZLP that ends a transfer whose last packet was full
+    usb_bulkFlush();
+}
+
+/*!
+ * @brief Executes a single command and stages its completion
+ */
+static void _execute(const uint8_t seq, const uint8_t opcode, const uint8_t *payload, const uint8_t len) {
+    uint8_t *result = &_completion[CMD_HEADER_SIZE];
+    uint8_t resultLen = 0;
+    uint8_t status = CMD_STATUS_OK;
+    uint32_t mask = 0;
+
+    if((opcode == CMD_OP_REGISTRY_READ) || (opcode == CMD_OP_REGISTRY_WRITE)) {
+        if(len < sizeof(mask)) {
+            status = CMD_STATUS_BAD_LENGTH;
+        }
+        else {
+            memcpy(&mask, payload, sizeof(mask));
+        }
+    }
+
+    if(status == CMD_STATUS_OK) {
+        switch(opcode) {
+            case CMD_OP_NOP:
+                break;
+
+            case CMD_OP_ECHO:
+                memcpy(result, payload, len);
+                resultLen = len;
+                break;
+
+            case CMD_OP_REGISTRY_READ:
+                resultLen = registry_read(mask, result, CMD_MAX_PAYLOAD);
+                if(!resultLen) {
+                    status = CMD_STATUS_FAILED;
+                }
+                break;
+
+            case CMD_OP_REGISTRY_WRITE:
+                if(!registry_write(mask, &payload[sizeof(mask)], len - sizeof(mask))) {
+                    status = CMD_STATUS_FAILED;
+                }
+                break;
+
+            default:
+                status = CMD_STATUS_BAD_OPCODE;
+                break;
+        }
+    }
+
+    _completion[0] = seq;
+    _completion[1] = status;
+    _completion[2] = resultLen;
+    _completion_len = CMD_HEADER_SIZE + resultLen;
+}
@@ -0,0 +1,46 @@
+#ifndef _CMD_H_
+#define _CMD_H_
+
+#include <stdint.h>
+
+/*
+ * Commands are streamed by the host over the bulk OUT endpoint and may span
+ * packets. Each one is:
+ *   [seq][opcode][len][payload (len bytes)]
+ * Every command produces exactly one completion on the bulk IN endpoint:
+ *   [seq][status][len][payload (len bytes)]
+ * Completions never span packets and are batched until a packet is full or
+ * no more commands are waiting, so one bulk IN packet usually completes many
+ * commands.
+ */
+
+/*! @brief Size of the command and completion headers */
+#define CMD_HEADER_SIZE         (3)
+/*! @brief Largest command or completion payload */
+#define CMD_MAX_PAYLOAD         (61)
+
+/*! @brief Command opcodes */
+#define CMD_OP_NOP              (0x00) // Completes with no payload
+#define CMD_OP_ECHO             (0x01) // Completes with the command payload
+#define CMD_OP_REGISTRY_READ    (0x02) // Payload is a 32 bit id mask, completes with the packed values
+#define CMD_OP_REGISTRY_WRITE   (0x03) // Payload is a 32 bit id mask followed by the packed values
+
+/*! @brief Completion status codes */
+#define CMD_STATUS_OK           (0x00)
+#define CMD_STATUS_BAD_OPCODE   (0x01)
+#define CMD_STATUS_BAD_LENGTH   (0x02)
+#define CMD_STATUS_FAILED       (0x03)
+
+/*!
+ * @brief This API executes queued commands and queues their completions.
+ * It is the WORK_USB_BULK worker and must never be called from an ISR. It
+ * returns when no complete command is waiting or the bulk IN endpoint has
+ * no free bank, and the USB ISR posts it again when either changes.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void cmd_task(void);
+
+#endif // _CMD_H_
@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "led.h"
+
+#define LED_DDR         (DDRD)
+#define LED_PORT        (PORTD)
+#define LED_PIN         (4)
+
+/*! @brief Steps of the running pattern */
+static led_step_t _steps[LED_MAX_STEPS];
+/*! @brief Number of steps in the running pattern, 0 when off */
+static uint8_t _numSteps = 0;
+/*! @brief Step being played */
+static uint8_t _step = 0;
+/*! @brief Plays of the pattern left, LED_REPEAT_FOREVER to never stop */
+static uint8_t _repeat = LED_REPEAT_FOREVER;
+/*! @brief True once the last play has finished and the LED is holding */
+static bool _done = false;
+/*! @brief LED periods spent in the current step */
+static uint16_t _elapsed = 0;
+/*! @brief Brightness when the current step started, faded from */
+static uint8_t _from = 0;
+/*! @brief Current brightness */
+static uint8_t _brightness = 0;
+
+static void _run(const uint8_t numSteps, const uint8_t repeat);
+static void _enterStep(const uint8_t step);
+static void _setBrightness(const uint8_t brightness);
+
+/*!
+ * @brief This API initializes the LED pin and Timer1
+ */
+void led_init(void) {
+    // Set our LED port as an output, starting off
+    LED_DDR |= (1 << LED_PIN);
+    LED_PORT &= ~(1 << LED_PIN);
+
+    // Configure TIMER1 for 8-bit fast PWM with a CLK/64 pre-scaler, which
+    // overflows every 1.024ms. Our LED isn't on an output compare pin, so
+    // instead of the timer driving the pin the overflow interrupt turns it
+    // on and the compare A interrupt turns it off again. The interrupts are
+    // only enabled while a pattern needs them.
+    TCCR1A = (1 << WGM10);
+    TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+    TIMSK1 = 0x00;
+}
+
+/*!
+ * @brief This API replaces the running pattern with packed steps
+ */
+bool led_setPattern(const uint8_t *data, const uint16_t len, const uint8_t repeat) {
+    if((len % LED_STEP_SIZE) || (len > (LED_MAX_STEPS * LED_STEP_SIZE))) {
+        return false;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for(uint8_t i = 0; i < (len / LED_STEP_SIZE); i++) {
+            const uint8_t *step = &data[i * LED_STEP_SIZE];
+            _steps[i].brightness = step[0];
+            _steps[i].flags = step[1];
+            _steps[i].duration = step[2] | (step[3] << 8);
+        }
+        _run(len / LED_STEP_SIZE, repeat);
+    }
+
+    return true;
+}
+
+/*!
+ * @brief This API replaces the running pattern with a plain blink
+ */
+void led_setBlink(const uint16_t period) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if(period == 0) {
+            _run(0, LED_REPEAT_FOREVER);
+        }
+        else {
+            _steps[0] = (led_step_t){.brightness = 255, .flags = 0, .duration = period};
+            _steps[1] = (led_step_t){.brightness = 0, .flags = 0, .duration = period};
+            _run(2, LED_REPEAT_FOREVER);
+        }
+    }
+}
+
+/*!
+ * @brief Starts playing the steps in _steps. Interrupts must be disabled.
+ */
+static void _run(const uint8_t numSteps, const uint8_t repeat) {
+    _numSteps = numSteps;
+    _repeat = repeat;
+    _done = false;
+
+    if(numSteps == 0) {
+        // No pattern, the LED is off and the timer interrupts stay quiet
+        TIMSK1 = 0x00;
+        _setBrightness(0);
+        LED_PORT &= ~(1 << LED_PIN);
+        return;
+    }
+
+    _enterStep(0);
+
+    // Start from the beginning of a PWM period
+    TCNT1 = 0;
+    TIFR1 = (1 << TOV1) | (1 << OCF1A);
+    TIMSK1 = (1 << TOIE1) | (1 << OCIE1A);
+}
+
+/*!
+ * @brief Moves the pattern on to the given step
+ */
+static void _enterStep(const uint8_t step) {
+    _step = step;
+    _elapsed = 0;
+    _from = _brightness;
+
+    // Fading steps start where the last one left off
+    if(!(_steps[step].flags & LED_STEP_FADE)) {
+        _setBrightness(_steps[step].brightness);
+    }
+}
+
+/*!
+ * @brief Sets the PWM duty cycle. OCR1A is double buffered and takes
+ * effect at the start of the next PWM period.
+ */
+static void _setBrightness(const uint8_t brightness) {
+    _brightness = brightness;
+    OCR1A = brightness;
+}
+
+/*!
+ * @brief ISR for the Timer1 overflow interrupt, the start of each PWM period
+ */
+ISR(TIMER1_OVF_vect)
+{
+    // Turn the LED on for this period unless it should be dark
+    if(_brightness) {
+        LED_PORT |= (1 << LED_PIN);
+    }
+
+    if(_done) {
+        return;
+    }
+
+    const led_step_t *step = &_steps[_step];
+
+    if(++_elapsed < step->duration) {
+        // Part way through a fade, move the brightness along
+        if(step->flags & LED_STEP_FADE) {
+            int16_t delta = (int16_t)step->brightness - _from;
+            _setBrightness(_from + (int16_t)(((int32_t)delta * _elapsed) / step->duration));
+        }
+        return;
+    }
+
+    // The step is over. Make sure a fade finished on its target.
+    _setBrightness(step->brightness);
+
+    if((_step + 1) < _numSteps) {
+        _enterStep(_step + 1);
+    }
+    else if(_repeat != 1) {
+        // Play the pattern again
+        if(_repeat != LED_REPEAT_FOREVER) {
+            _repeat--;
+        }
+        _enterStep(0);
+    }
+    else {
+        // Finished, hold the last brightness. Fully on or off
+        // doesn't need the timer so leave the pin to itself.
+        _done = true;
+        if((_brightness == 0) || (_brightness == 255)) {
+            TIMSK1 = 0x00;
+            if(_brightness) {
+                LED_PORT |= (1 << LED_PIN);
+            }
+            else {
+                LED_PORT &= ~(1 << LED_PIN);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief ISR for the Timer1 compare A interrupt, the end of the on time
+ */
+ISR(TIMER1_COMPA_vect)
+{
+    // Fully on never turns off
+    if(_brightness < 255) {
+        LED_PORT &= ~(1 << LED_PIN);
+    }
+}
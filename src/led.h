@@ -0,0 +1,62 @@
+#ifndef _LED_H_
+#define _LED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! @brief Most steps a pattern can have */
+#define LED_MAX_STEPS           (16)
+/*! @brief Size in bytes of one step as uploaded by the host */
+#define LED_STEP_SIZE           (4)
+
+/*! @brief Step flags */
+#define LED_STEP_FADE           (1 << 0)    // Ramp from the previous brightness instead of jumping
+
+/*! @brief Repeat count that plays a pattern until it is replaced */
+#define LED_REPEAT_FOREVER      (0)
+
+/*!
+ * @brief One step of an LED pattern
+ */
+typedef struct {
+    uint8_t brightness;     // 0 (off) to 255 (fully on)
+    uint8_t flags;          // LED_STEP_*
+    uint16_t duration;      // Length of the step in LED periods (1.024ms)
+} led_step_t;
+
+/*!
+ * @brief This API initializes the LED pin and Timer1. The LED is off until
+ * a pattern is set.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void led_init(void);
+
+/*!
+ * @brief This API replaces the running pattern with one packed as
+ * LED_STEP_SIZE byte steps: brightness, flags, duration (little endian).
+ * Once the last step ends the LED holds its brightness. Safe to call
+ * from an ISR.
+ *
+ * @param[in] data : Packed steps
+ * @param[in] len : Number of bytes in data
+ * @param[in] repeat : Times to play the pattern, or LED_REPEAT_FOREVER
+ *
+ * @returns Returns false, leaving the running pattern alone, if len is
+ * not a whole number of steps or there are more than LED_MAX_STEPS.
+ */
+bool led_setPattern(const uint8_t *data, const uint16_t len, const uint8_t repeat);
+
+/*!
+ * @brief This API replaces the running pattern with a plain blink,
+ * fully on and fully off for period each. Safe to call from an ISR.
+ *
+ * @param[in] period : Time on and time off in LED periods, 0 turns the LED off
+ *
+ * @returns Returns void
+ */
+void led_setBlink(const uint16_t period);
+
+#endif // _LED_H_
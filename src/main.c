@@ -4,47 +4,130 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
 #include "usb.h"
 #include "tick.h"
-
-#define LED_STAT_DDR        (DDRD)
-#define LED_STAT_PORT       (PORTD)
-#define LED_STAT_PIN        (4)
+#include "led.h"
+#include "registry.h"
+#include "cmd.h"
+#include "version.h"
+#include "protocol.h"
+#include "report.h"
+#include "work.h"
 
 #define PB_DDR              (DDRB)
 #define PB_PORT             (PORTB)
 #define PB_PIN              (6)
 
-typedef union {
-    struct {
-        uint8_t sw0     : 1;
-        uint8_t sw1     : 1;
-        uint8_t sw2     : 1;
-        uint8_t rsvd    : 5;
-    } bits;
-    uint8_t byte;
-} pb_status_t;
+// Registry ids for the variables the host can access
+#define VAR_ID_LED_FLASH_RATE   0
+#define VAR_ID_BUTTONS          1
+#define VAR_ID_VERSION          2
+#define VAR_ID_USB_ISR_ENTRIES  3
+#define VAR_ID_USB_ISR_EVENTS   4
+#define VAR_ID_USB_ISR_REENTRIES 5
+#define VAR_ID_USB_ISR_BUSY_US  6
+#define VAR_ID_USB_ISR_MAX_US   7
+#define VAR_ID_USB_ENUM_RESETS  8
+#define VAR_ID_USB_ENUM_US      9
+#define VAR_ID_USB_ENUM_REQUESTS 10
+#define VAR_ID_USB_ENUM_STALLS  11
+#define VAR_ID_CONTROL_DELAY_MS 12
+#define VAR_ID_INT_IN_MAX_LATENCY_US 13
+#define VAR_ID_BULK_MAX_LATENCY_US 14
+#define VAR_ID_CONTROL_MAX_RUN_US 15
+#define VAR_ID_CONTROL_DELAY_YIELD 16
 
 uint16_t led_flash_rate = 0;
+// Makes the vendor 0x01/0x02 callbacks take this long, to check a slow
+// control request doesn't hold up the streaming endpoints
+uint16_t control_delay_ms = 0;
+// Whether they yield every millisecond while they do. Clear it to see what
+// a callback that doesn't yield costs the other endpoints.
+uint8_t control_delay_yield = 1;
 pb_status_t buttons = {0x00};
+const uint8_t firmware_version[] = {VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH};
+
+// Table of variables that can be read and written in batches by the host
+const registry_entry_t PROGMEM variables[] = {
+    REGISTRY_ENTRY(VAR_ID_LED_FLASH_RATE,   led_flash_rate,     REGISTRY_READ | REGISTRY_WRITE),
+    REGISTRY_ENTRY(VAR_ID_BUTTONS,          buttons.byte,       REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_VERSION,          firmware_version,   REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ISR_ENTRIES,  usb_isrStats.entries,       REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ISR_EVENTS,   usb_isrStats.events,        REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ISR_REENTRIES, usb_isrStats.reentries,    REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ISR_BUSY_US,  usb_isrStats.busyMicros,    REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ISR_MAX_US,   usb_isrStats.maxMicros,     REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ENUM_RESETS,  usb_enumStats.resets,       REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ENUM_US,      usb_enumStats.micros,       REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ENUM_REQUESTS, usb_enumStats.requests,    REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_USB_ENUM_STALLS,  usb_enumStats.stalls,       REGISTRY_READ),
+    REGISTRY_ENTRY(VAR_ID_CONTROL_DELAY_MS, control_delay_ms,           REGISTRY_READ | REGISTRY_WRITE),
+    // Writable so the host can zero them between measurements
+    REGISTRY_ENTRY(VAR_ID_INT_IN_MAX_LATENCY_US, work_stats[WORK_USB_INT_IN].maxLatencyMicros, REGISTRY_READ | REGISTRY_WRITE),
+    REGISTRY_ENTRY(VAR_ID_BULK_MAX_LATENCY_US, work_stats[WORK_USB_BULK].maxLatencyMicros,     REGISTRY_READ | REGISTRY_WRITE),
+    REGISTRY_ENTRY(VAR_ID_CONTROL_MAX_RUN_US, work_stats[WORK_USB_CONTROL].maxRunMicros,       REGISTRY_READ | REGISTRY_WRITE),
+    REGISTRY_ENTRY(VAR_ID_CONTROL_DELAY_YIELD, control_delay_yield,     REGISTRY_READ | REGISTRY_WRITE),
+};
+
+static void slowControl(void) {
+    for(uint16_t i = 0; i < control_delay_ms; i++) {
+        _delay_ms(1);
+        // Reports and commands posted meanwhile go out now. Without
+        // this they wait for the whole delay, see usb.h.
+        if(control_delay_yield) {
+            work_yield();
+        }
+    }
+}
 
 void onUsbControlWrite(uint16_t rxData) {
+    slowControl();
     led_flash_rate = rxData;
+    led_setBlink(led_flash_rate);
+}
+
+void onRegistryWrite(const uint32_t mask) {
+    // The LED runs from a timer, hand it the new rate
+    if(mask & ((uint32_t)1 << VAR_ID_LED_FLASH_RATE)) {
+        led_setBlink(led_flash_rate);
+    }
 }
 
 uint16_t onUsbControlRead(uint8_t *txData, const uint16_t requestedTxLen) {
     uint16_t txLen = 1;
 
+    slowControl();
     txData[0] = 0x03;
 
     return txLen;
 }
 
+/*!
+ * @brief Button edges. PD0-PD2 are INT0-INT2, set to fire on any change,
+ * so every press and release is timestamped as it happens whatever the
+ * main loop is busy with.
+ */
+ISR(INT0_vect) {
+    // Read our PIND and mask off the bottom 3 bits
+    uint8_t state = (PIND & 0x07);
+
+    // A bounce can be over before we get here, only report real changes
+    if(state != buttons.byte) {
+        buttons.byte = state;
+        report_sample(state);
+    }
+}
+ISR(INT1_vect, ISR_ALIASOF(INT0_vect));
+ISR(INT2_vect, ISR_ALIASOF(INT0_vect));
+
 int main(void) {
-    uint32_t ledFlashRefTime = 0x0000;
+    // A firmware update resets us via the watchdog, which stays
+    // enabled across the reset. Turn it off before it fires again.
+    MCUSR &= ~(1 << WDRF);
+    wdt_disable();
 
-    // Set our LED port as an output
-    LED_STAT_DDR |= (1 << LED_STAT_PIN);
     // Set our PB pin as an input
     PB_DDR &= ~(1 << PB_PIN);
 
@@ -52,6 +135,27 @@ int main(void) {
     // delay functionality
     tick_init();
 
+    // Init the LED pattern engine. It runs from Timer1
+    // without any help from the main loop.
+    led_init();
+
+    // Hand our variable table to the registry so the
+    // host can access it via vendor requests
+    registry_init(variables, sizeof(variables) / sizeof(variables[0]));
+    registry_setWriteCallback(onRegistryWrite);
+
+    // The streaming endpoints are served by workers in the main loop
+    work_register(WORK_USB_INT_IN, report_task);
+    work_register(WORK_USB_BULK, cmd_task);
+
+    // Sample the buttons from their pin interrupts, any edge on INT0-INT2.
+    // Report the initial state before the first edge comes along.
+    EICRA = (1 << ISC00) | (1 << ISC10) | (1 << ISC20);
+    EIFR = (1 << INTF0) | (1 << INTF1) | (1 << INTF2);
+    EIMSK |= (1 << INT0) | (1 << INT1) | (1 << INT2);
+    buttons.byte = (PIND & 0x07);
+    report_sample(buttons.byte);
+
     // Init USB and provide it our callback function
     // to be called when data is received via a
     // Control Write transfer
@@ -60,26 +164,10 @@ int main(void) {
     // Enable global interrupts
     sei();
 
-    // Store our initial led flash reference time
-    ledFlashRefTime = tick_getTick();
-
     while(1) {
-        // Read our PIND and mask off the bottom 3 bits
-        buttons.byte = (PIND & 0x07);
-
-        // Update our status for the next interrupt transfer
-        usb_sendInterruptData(&buttons.byte, 1);
-
-        // Flash the LED if necessary
-        if(led_flash_rate && (tick_timeSince(ledFlashRefTime) >= led_flash_rate)) {
-            // Toggle our LED
-            LED_STAT_PORT ^= (1 << LED_STAT_PIN);
-            // Update our reference time
-            ledFlashRefTime = tick_getTick();
-        }
-        else if(!led_flash_rate) {
-            // Turn off our LED
-            LED_STAT_PORT &= ~(1 << LED_STAT_PIN);
-        }
+        // Run whatever the USB and button ISRs have posted: reports, then
+        // pipelined commands, then control requests. A slow control request
+        // yields to the others while it waits (see work_yield()).
+        work_run();
     }
 }
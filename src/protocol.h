@@ -0,0 +1,59 @@
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+#include <stdint.h>
+
+/*
+ * Definitions shared by the firmware and the host tools. Anything the two
+ * sides have to agree on about the interrupt IN reports lives here.
+ *
+ * A report carries every button state change since the previous report:
+ *
+ *   byte 0     PROTOCOL_VERSION
+ *   byte 1     Number of samples that follow
+ *   byte 2     Samples the device had to drop since the previous report (saturates at 255)
+ *   byte 3     Reserved, 0
+ *   bytes 4-7  Device time of the first sample in microseconds, little endian
+ *   bytes 8-   Samples, 16 bits each, little endian
+ *
+ * Each sample holds the button state in its low PROTOCOL_SAMPLE_STATE_BITS and
+ * the time since the previous sample in the rest, in PROTOCOL_SAMPLE_DELTA_US
+ * units. The first sample's delta is always 0.
+ */
+
+/*! @brief Version of the report format. Bumped on any incompatible change */
+#define PROTOCOL_VERSION                (1)
+
+/*! @brief Largest report, the interrupt IN endpoint size */
+#define PROTOCOL_REPORT_SIZE            (64)
+/*! @brief Size of the report header */
+#define PROTOCOL_HEADER_SIZE            (8)
+/*! @brief Size of one sample */
+#define PROTOCOL_SAMPLE_SIZE            (2)
+/*! @brief Most samples a report can carry */
+#define PROTOCOL_MAX_SAMPLES            ((PROTOCOL_REPORT_SIZE - PROTOCOL_HEADER_SIZE) / PROTOCOL_SAMPLE_SIZE)
+
+/*! @brief Sample encoding */
+#define PROTOCOL_SAMPLE_STATE_BITS      (3)
+#define PROTOCOL_SAMPLE_STATE_MASK      ((1 << PROTOCOL_SAMPLE_STATE_BITS) - 1)
+#define PROTOCOL_SAMPLE_DELTA_US        (8)
+#define PROTOCOL_SAMPLE_DELTA_MAX       (0xFFFF >> PROTOCOL_SAMPLE_STATE_BITS)
+
+#define PROTOCOL_SAMPLE(state, delta)   ((uint16_t)(((delta) << PROTOCOL_SAMPLE_STATE_BITS) | ((state) & PROTOCOL_SAMPLE_STATE_MASK)))
+#define PROTOCOL_SAMPLE_STATE(sample)   ((sample) & PROTOCOL_SAMPLE_STATE_MASK)
+#define PROTOCOL_SAMPLE_DELTA(sample)   ((sample) >> PROTOCOL_SAMPLE_STATE_BITS)
+
+/*!
+ * @brief State of the push buttons, as carried in a sample
+ */
+typedef union {
+    struct {
+        uint8_t sw0     : 1;
+        uint8_t sw1     : 1;
+        uint8_t sw2     : 1;
+        uint8_t rsvd    : 5;
+    } bits;
+    uint8_t byte;
+} pb_status_t;
+
+#endif // _PROTOCOL_H_
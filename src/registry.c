@@ -0,0 +1,142 @@
+#include <stdbool.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "registry.h"
+
+/*! @brief Application variable table (stored in PROGMEM) */
+static const registry_entry_t *_table = NULL;
+/*! @brief Number of entries in the table */
+static uint8_t _count = 0;
+/*! @brief Run after every successful write */
+static registry_write_cb_t _write_cb = NULL;
+
+static bool _findEntry(const uint8_t id, registry_entry_t *entry);
+static int32_t _packedSize(const uint32_t mask, const uint8_t access);
+
+/*!
+ * @brief This API stores the application's variable table
+ */
+void registry_init(const registry_entry_t *table, const uint8_t count) {
+    _table = table;
+    _count = count;
+}
+
+/*!
+ * @brief This API registers a callback run after every successful write
+ */
+void registry_setWriteCallback(registry_write_cb_t cb) {
+    _write_cb = cb;
+}
+
+/*!
+ * @brief This API serializes the table as (id, size, access) triplets
+ */
+uint16_t registry_describe(uint8_t *txData, const uint16_t maxLen) {
+    registry_entry_t entry;
+    uint16_t txLen = 0;
+
+    for(uint8_t i = 0; i < _count; i++) {
+        if((txLen + REGISTRY_DESC_SIZE) > maxLen) {
+            break;
+        }
+
+        memcpy_P(&entry, &_table[i], sizeof(entry));
+        txData[txLen++] = entry.id;
+        txData[txLen++] = entry.size;
+        txData[txLen++] = entry.access;
+    }
+
+    return txLen;
+}
+
+/*!
+ * @brief This API reads every variable selected in mask
+ */
+uint16_t registry_read(const uint32_t mask, uint8_t *txData, const uint16_t maxLen) {
+    registry_entry_t entry;
+    uint16_t txLen = 0;
+    int32_t packedSize = _packedSize(mask, REGISTRY_READ);
+
+    // Validate the whole batch up front so the host either
+    // gets every value it asked for or an error.
+    if((packedSize <= 0) || (packedSize > maxLen)) {
+        return 0;
+    }
+
+    for(uint8_t id = 0; id <= REGISTRY_MAX_ID; id++) {
+        if(mask & ((uint32_t)1 << id)) {
+            _findEntry(id, &entry);
+            // Variables may be updated from ISRs so copy
+            // them out atomically.
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                memcpy(&txData[txLen], entry.addr, entry.size);
+            }
+            txLen += entry.size;
+        }
+    }
+
+    return txLen;
+}
+
+/*!
+ * @brief This API writes every variable selected in mask
+ */
+bool registry_write(const uint32_t mask, const uint8_t *rxData, const uint16_t len) {
+    registry_entry_t entry;
+    uint16_t rxIdx = 0;
+
+    if(_packedSize(mask, REGISTRY_WRITE) != len) {
+        return false;
+    }
+
+    for(uint8_t id = 0; id <= REGISTRY_MAX_ID; id++) {
+        if(mask & ((uint32_t)1 << id)) {
+            _findEntry(id, &entry);
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                memcpy(entry.addr, &rxData[rxIdx], entry.size);
+            }
+            rxIdx += entry.size;
+        }
+    }
+
+    if(_write_cb != NULL) {
+        _write_cb(mask);
+    }
+
+    return true;
+}
+
+/*!
+ * @brief Copies the table entry with the given id out of PROGMEM
+ */
+static bool _findEntry(const uint8_t id, registry_entry_t *entry) {
+    for(uint8_t i = 0; i < _count; i++) {
+        if(pgm_read_byte(&_table[i].id) == id) {
+            memcpy_P(entry, &_table[i], sizeof(*entry));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * @brief Returns the packed size of the variables selected in mask,
+ * or -1 if any of them is missing or lacks the required access.
+ */
+static int32_t _packedSize(const uint32_t mask, const uint8_t access) {
+    registry_entry_t entry;
+    int32_t size = 0;
+
+    for(uint8_t id = 0; id <= REGISTRY_MAX_ID; id++) {
+        if(mask & ((uint32_t)1 << id)) {
+            if(!_findEntry(id, &entry) || !(entry.access & access)) {
+                return -1;
+            }
+            size += entry.size;
+        }
+    }
+
+    return size;
+}
@@ -0,0 +1,95 @@
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! @brief Largest variable id. Ids are addressed by bit in a 32-bit mask */
+#define REGISTRY_MAX_ID         (31)
+
+/*! @brief Access flags for a registry entry */
+#define REGISTRY_READ           (1 << 0)
+#define REGISTRY_WRITE          (1 << 1)
+
+/*! @brief Size in bytes of each entry returned by registry_describe() */
+#define REGISTRY_DESC_SIZE      (3)
+
+/*!
+ * @brief Describes one variable that can be accessed by the host
+ */
+typedef struct {
+    uint8_t id;         // Id used by the host to address the variable (0 - REGISTRY_MAX_ID)
+    void *addr;         // Address of the variable in RAM
+    uint8_t size;       // Size of the variable in bytes
+    uint8_t access;     // REGISTRY_READ and/or REGISTRY_WRITE
+} registry_entry_t;
+
+/*! @brief Called after a successful write with the mask of the variables written */
+typedef void (*registry_write_cb_t)(const uint32_t mask);
+
+/*!
+ * @brief Helper for building a registry table entry from a variable
+ */
+#define REGISTRY_ENTRY(_id, _var, _access) \
+    { .id = (_id), .addr = (void*)&(_var), .size = sizeof(_var), .access = (_access) }
+
+/*!
+ * @brief This API stores the application's variable table
+ *
+ * @param[in] table : Table of entries stored in PROGMEM
+ * @param[in] count : Number of entries in the table
+ *
+ * @returns Returns void
+ */
+void registry_init(const registry_entry_t *table, const uint8_t count);
+
+/*!
+ * @brief This API registers a callback that is run after every successful
+ * registry_write(), so the application can act on new values. It may be
+ * called from the USB ISR.
+ *
+ * @param[in] cb : Callback, or NULL to remove it
+ *
+ * @returns Returns void
+ */
+void registry_setWriteCallback(registry_write_cb_t cb);
+
+/*!
+ * @brief This API serializes the table as (id, size, access) triplets
+ * so the host knows how to encode and decode a batch.
+ *
+ * @param[out] txData : Buffer to serialize into
+ * @param[in] maxLen : Size of the buffer
+ *
+ * @returns Returns the number of bytes written to txData
+ */
+uint16_t registry_describe(uint8_t *txData, const uint16_t maxLen);
+
+/*!
+ * @brief This API reads every variable selected in mask. Values are
+ * packed back to back in ascending id order, little endian.
+ *
+ * @param[in] mask : Bit n selects the variable with id n
+ * @param[out] txData : Buffer to pack the values into
+ * @param[in] maxLen : Size of the buffer
+ *
+ * @returns Returns the number of bytes written to txData, or 0 if a
+ * selected id does not exist, is not readable or does not fit.
+ */
+uint16_t registry_read(const uint32_t mask, uint8_t *txData, const uint16_t maxLen);
+
+/*!
+ * @brief This API writes every variable selected in mask from values
+ * packed in the same layout registry_read() produces.
+ *
+ * @param[in] mask : Bit n selects the variable with id n
+ * @param[in] rxData : Packed values
+ * @param[in] len : Number of bytes in rxData
+ *
+ * @returns Returns true if every selected variable was written. Nothing
+ * is written if a selected id does not exist, is not writable or len does
+ * not match the packed size.
+ */
+bool registry_write(const uint32_t mask, const uint8_t *rxData, const uint16_t len);
+
+#endif // _REGISTRY_H_
@@ -0,0 +1,117 @@
+#include <stdbool.h>
+#include <util/atomic.h>
+#include "report.h"
+#include "protocol.h"
+#include "usb.h"
+#include "tick.h"
+#include "work.h"
+
+typedef struct {
+    uint32_t micros;
+    uint8_t state;
+} _sample_t;
+
+/*! @brief Samples waiting to be reported. The head and tail are
+ * free running and only wrap at 256. Samples are added from the
+ * button ISR, which owns _head; report_task() owns _tail. */
+static _sample_t _queue[REPORT_QUEUE_SIZE];
+static volatile uint8_t _head = 0;
+static uint8_t _tail = 0;
+/*! @brief Samples dropped since the last report */
+static volatile uint8_t _dropped = 0;
+
+static uint8_t _samplesThatFit(void);
+
+/*!
+ * @brief This API timestamps a button state and queues it
+ */
+void report_sample(const uint8_t state) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if((uint8_t)(_head - _tail) >= REPORT_QUEUE_SIZE) {
+            if(_dropped < UINT8_MAX) {
+                _dropped++;
+            }
+        }
+        else {
+            uint8_t head = _head;
+            _queue[head % REPORT_QUEUE_SIZE].micros = tick_getMicros();
+            _queue[head % REPORT_QUEUE_SIZE].state = state & PROTOCOL_SAMPLE_STATE_MASK;
+            _head = head + 1;
+
+            work_post(WORK_USB_INT_IN);
+        }
+    }
+}
+
+/*!
+ * @brief This API sends queued samples once the endpoint has room
+ */
+void report_task(void) {
+    // Only build a report when it can go straight into the FIFO. Until
+    // then samples keep collecting so the next report carries them all.
+    if((_head == _tail) || !usb_reportReady() || !usb_reportClaim()) {
+        return;
+    }
+
+    uint8_t count = _samplesThatFit();
+    uint32_t base = _queue[_tail % REPORT_QUEUE_SIZE].micros;
+    uint32_t time = base;
+    uint8_t dropped;
+
+    // Drops from here on are counted in the next report
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        dropped = _dropped;
+        _dropped = 0;
+    }
+
+    usb_reportWrite(PROTOCOL_VERSION);
+    usb_reportWrite(count);
+    usb_reportWrite(dropped);
+    usb_reportWrite(0x00);
+    usb_reportWrite(base & 0xFF);
+    usb_reportWrite((base >> 8) & 0xFF);
+    usb_reportWrite((base >> 16) & 0xFF);
+    usb_reportWrite((base >> 24) & 0xFF);
+
+    for(uint8_t i = 0; i < count; i++) {
+        const _sample_t *sample = &_queue[(uint8_t)(_tail + i) % REPORT_QUEUE_SIZE];
+        // Deltas are measured from the previous sample's rounded time so
+        // the rounding errors don't add up along the report
+        uint16_t delta = (sample->micros - time) / PROTOCOL_SAMPLE_DELTA_US;
+        time += (uint32_t)delta * PROTOCOL_SAMPLE_DELTA_US;
+
+        uint16_t packed = PROTOCOL_SAMPLE(sample->state, delta);
+        usb_reportWrite(packed & 0xFF);
+        usb_reportWrite(packed >> 8);
+    }
+
+    usb_reportCommit();
+
+    _tail += count;
+
+    // Come back for the rest if they didn't all fit
+    if(_head != _tail) {
+        work_post(WORK_USB_INT_IN);
+    }
+}
+
+/*!
+ * @brief Returns how many queued samples, oldest first, fit in one report.
+ * A sample too long after the previous one for its delta to be encoded
+ * starts the next report instead.
+ */
+static uint8_t _samplesThatFit(void) {
+    uint8_t count = 1;
+    uint32_t time = _queue[_tail % REPORT_QUEUE_SIZE].micros;
+
+    while((count < PROTOCOL_MAX_SAMPLES) && ((uint8_t)(_tail + count) != _head)) {
+        uint32_t delta = (_queue[(uint8_t)(_tail + count) % REPORT_QUEUE_SIZE].micros - time) / PROTOCOL_SAMPLE_DELTA_US;
+        if(delta > PROTOCOL_SAMPLE_DELTA_MAX) {
+            break;
+        }
+        time += delta * PROTOCOL_SAMPLE_DELTA_US;
+        count++;
+    }
+
+    return count;
+}
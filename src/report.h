@@ -0,0 +1,32 @@
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+#include <stdint.h>
+
+/*! @brief Samples buffered while waiting for the host. Must be a power of 2 no larger than 128 */
+#define REPORT_QUEUE_SIZE       (32)
+
+/*!
+ * @brief This API timestamps a button state and queues it for the next
+ * interrupt IN report. If the queue is full the sample is dropped and
+ * the drop is counted in the next report. Safe to call from an ISR, the
+ * buttons are sampled from their pin change interrupts.
+ *
+ * @param[in] state : Button state, see pb_status_t
+ *
+ * @returns Returns void
+ */
+void report_sample(const uint8_t state);
+
+/*!
+ * @brief This API packs as many queued samples as fit into a report and
+ * writes it straight into the endpoint when it has a free bank. It is the
+ * WORK_USB_INT_IN worker, report_sample() and the USB ISR post it.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void report_task(void);
+
+#endif // _REPORT_H_
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdio.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "tick.h"
 
 #define TICK_PERIOD (1) // ms
 
@@ -46,6 +48,26 @@ uint32_t tick_timeSince(const uint32_t ref) {
     return (tick_val - ref);
 }
 
+/*!
+ * @brief This API returns a free running microsecond timestamp
+ */
+uint32_t tick_getMicros(void) {
+    uint32_t ticks;
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks = tick_val;
+        count = TCNT0;
+        // The timer may have overflowed without the ISR having run yet.
+        // A low count means the overflow happened before we read it.
+        if((TIFR0 & (1 << TOV0)) && (count < 128)) {
+            ticks++;
+        }
+    }
+
+    return (ticks * TICK_MICROS_PER_TICK) + ((uint32_t)count * TICK_MICROS_PER_COUNT);
+}
+
 /*!
  * @brief ISR for the Timer0 overflow interrupt
  */
@@ -1,6 +1,12 @@
 #ifndef _TICK_H_
 #define _TICK_H_
 
+#include <stdint.h>
+
+/*! @brief Timer0 runs at CLK/64, 4us per count and 1024us per tick */
+#define TICK_MICROS_PER_COUNT   (4)
+#define TICK_MICROS_PER_TICK    (256 * TICK_MICROS_PER_COUNT)
+
 /*!
  * @brief This API initiliazes the tick module and timer
  *
@@ -29,4 +35,15 @@ uint32_t tick_getTick(void);
  */
 uint32_t tick_timeSince(const uint32_t ref);
 
+/*!
+ * @brief This API returns a free running microsecond timestamp
+ * with a resolution of TICK_MICROS_PER_COUNT. Safe to call
+ * from an ISR.
+ *
+ * @param[in] void
+ *
+ * @returns Returns the time in microseconds, wrapping at 2^32
+ */
+uint32_t tick_getMicros(void);
+
 #endif // _TICK_H_
\ No newline at end of file
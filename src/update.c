@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "update.h"
+#include "updater.h"
+
+static bool _updaterPresent(void);
+
+/*!
+ * @brief This API reports the page size and number of updatable pages
+ */
+uint16_t update_info(uint8_t *txData) {
+    // Report no updatable pages if there is no updater to program them
+    uint16_t numPages = (_updaterPresent() ? UPDATE_NUM_PAGES : 0);
+
+    txData[0] = (UPDATE_PAGE_SIZE & 0xFF);
+    txData[1] = (UPDATE_PAGE_SIZE >> 8);
+    txData[2] = (numPages & 0xFF);
+    txData[3] = (numPages >> 8);
+    // We are the application, not the updater
+    txData[4] = 0;
+
+    return UPDATE_INFO_SIZE;
+}
+
+/*!
+ * @brief This API starts the updater
+ */
+void update_start(void) {
+    // The updater polls the USB controller itself and our ISRs
+    // live in the section it is about to reprogram. It stays on
+    // the bus with our address and configuration.
+    cli();
+
+    updater_enter();
+}
+
+/*!
+ * @brief Checks that the updater was actually programmed
+ */
+static bool _updaterPresent(void) {
+    return (pgm_read_word(&updater_marker) == UPDATER_MARKER);
+}
@@ -0,0 +1,51 @@
+#ifndef _UPDATE_H_
+#define _UPDATE_H_
+
+#include <stdint.h>
+
+/*
+ * In-application firmware update. The host reads a CRC-16 of every
+ * application page, compares them against the new image and only sends
+ * the pages that differ. The work is done by the updater in the boot
+ * loader section (see updater.h): SPM instructions are only executed from
+ * there, and it owns the USB controller for the whole update so none of
+ * the application runs while it is being replaced. Everything below
+ * BOOT_SECTION_START can be updated; the boot section itself can not.
+ */
+
+#ifndef BOOT_SECTION_START
+#define BOOT_SECTION_START      (0x7000)
+#endif
+
+/*! @brief Size in bytes of a flash page */
+#define UPDATE_PAGE_SIZE        (SPM_PAGESIZE)
+/*! @brief Number of pages that can be updated */
+#define UPDATE_NUM_PAGES        (BOOT_SECTION_START / UPDATE_PAGE_SIZE)
+/*! @brief Size in bytes of each page hash */
+#define UPDATE_HASH_SIZE        (2)
+/*! @brief Size in bytes of the info returned by update_info() */
+#define UPDATE_INFO_SIZE        (5)
+/*! @brief Set in the last byte of the info when the updater is running */
+#define UPDATE_INFO_UPDATER     (0x01)
+
+/*!
+ * @brief This API reports the page size and number of updatable pages
+ *
+ * @param[out] txData : Buffer of at least UPDATE_INFO_SIZE bytes
+ *
+ * @returns Returns the number of bytes written to txData
+ */
+uint16_t update_info(uint8_t *txData);
+
+/*!
+ * @brief This API hands the device over to the boot section updater
+ * without leaving the bus. It does not return, the updater resets into
+ * the application once the update is complete.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void update_start(void);
+
+#endif // _UPDATE_H_
@@ -0,0 +1,432 @@
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include "update.h"
+#include "updater.h"
+#include "usb_descriptors.h"
+
+/*
+ * Everything in this file is linked into the boot loader section. While a
+ * page is being programmed the application section can't be read, and we
+ * may be replacing any of it, so nothing here may call into it. That rules
+ * out the application's ISRs (interrupts stay disabled), libgcc helpers
+ * (no divisions, no switch jump tables, no struct copies) and any library
+ * function that isn't a macro or always inlined. Initialised globals are
+ * ruled out too, we can be entered straight out of reset without the C
+ * runtime start up having run.
+ */
+
+// Control endpoint packet size. The same as the application's, we carry
+// on with the control endpoint it configured.
+#define CONTROL_EP_BANK_SIZE        USB_CONTROL_EP_SIZE
+
+// USB standard request codes
+#define GET_STATUS                  0x00
+#define SET_ADDRESS                 0x05
+#define GET_DESCRIPTOR              0x06
+#define SET_CONFIGURATION           0x09
+
+// USB descriptor types
+#define DESC_DEVICE                 1
+#define DESC_CONFIG                 2
+#define DESC_STRING                 3
+
+// bmRequestType type field, bits 5-6
+#define REQUEST_TYPE_MASK           0x60
+#define REQUEST_TYPE_STANDARD       0x00
+#define REQUEST_TYPE_VENDOR         0x40
+
+// Vendor specific request codes, shared with the application (see src/usb.c)
+#define VENDOR_REQ_UPDATE_INFO      0x06
+#define VENDOR_REQ_UPDATE_HASH      0x07
+#define VENDOR_REQ_UPDATE_WRITE     0x08
+#define VENDOR_REQ_UPDATE_REBOOT    0x09
+
+// First word of a JMP instruction to an address below 128KB. The second
+// word is the word address of the target.
+#define JMP_OPCODE                  0x940C
+
+_Static_assert(CONTROL_EP_BANK_SIZE == 8, "_controlInit() configures an 8 byte control endpoint");
+
+static void _updaterRun(void) BOOTLOADER_SECTION __attribute__((noreturn));
+static void _usbStart(void) BOOTLOADER_SECTION;
+static void _controlInit(void) BOOTLOADER_SECTION;
+static void _processSetupPacket(uint8_t *page) BOOTLOADER_SECTION;
+static void _sendControlData(const uint8_t *data, uint16_t length, const uint16_t wLength, const bool fromProgmem) BOOTLOADER_SECTION;
+static uint16_t _receiveControlData(uint8_t *data, const uint16_t length) BOOTLOADER_SECTION;
+static void _sendControlAck(void) BOOTLOADER_SECTION;
+static void _stallControl(void) BOOTLOADER_SECTION;
+static bool _waitControl(const uint8_t flags) BOOTLOADER_SECTION;
+static uint16_t _hashPage(const uint16_t page) BOOTLOADER_SECTION;
+static void _writePage(const uint16_t page, const uint8_t *data) BOOTLOADER_SECTION;
+static void _writeRecoveryPage(void) BOOTLOADER_SECTION;
+static bool _recoveryPagePresent(void) BOOTLOADER_SECTION;
+
+const uint16_t updater_marker BOOTLOADER_SECTION = UPDATER_MARKER;
+
+// The application's descriptors, so we are the same device to the host
+static const uint8_t _deviceDescriptor[] BOOTLOADER_SECTION = USB_DEVICE_DESCRIPTOR;
+static const uint8_t _configDescriptor[] BOOTLOADER_SECTION = USB_CONFIG_DESCRIPTOR;
+static const uint8_t _languageDescriptor[] BOOTLOADER_SECTION = USB_LANGUAGE_DESCRIPTOR;
+static const uint8_t _manufacturerStringDescriptor[] BOOTLOADER_SECTION = USB_MANUFACTURER_STRING_DESCRIPTOR;
+static const uint8_t _productStringDescriptor[] BOOTLOADER_SECTION = USB_PRODUCT_STRING_DESCRIPTOR;
+static const uint8_t _serialStringDescriptor[] BOOTLOADER_SECTION = USB_SERIAL_STRING_DESCRIPTOR;
+
+/*!
+ * @brief This API starts the updater
+ */
+__attribute__((naked)) BOOTLOADER_SECTION void updater_enter(void) {
+    cli();
+    // We come here from the application or, via the recovery page, straight
+    // out of reset. Either way set up what the compiler relies on ourselves.
+    __asm__ __volatile__ ("clr __zero_reg__");
+    SP = RAMEND;
+
+    _updaterRun();
+}
+
+static void _updaterRun(void) {
+    uint8_t page[UPDATE_PAGE_SIZE];
+
+    // Coming from the application the controller is running and the host
+    // already knows us, carry on with it as it is. Out of reset (via the
+    // recovery page) it is off and we enumerate from scratch.
+    if(!(USBCON & (1 << USBE))) {
+        _usbStart();
+    }
+
+    while(1) {
+        // Bus reset, start enumerating again from the control endpoint
+        if(UDINT & (1 << EORSTI)) {
+            UDINT &= ~(1 << EORSTI);
+            _controlInit();
+        }
+
+        UENUM = 0;
+        if(UEINTX & (1 << RXSTPI)) {
+            _processSetupPacket(page);
+        }
+    }
+}
+
+/*!
+ * @brief Brings the USB controller up from whatever state it was left in
+ */
+static void _usbStart(void) {
+    // Clearing USBE resets the controller and every endpoint
+    USBCON = 0;
+    // No USB interrupts, everything is polled
+    UDIEN = 0;
+
+    // Power-On USB pads regulator
+    UHWCON |= (1 << UVREGE);
+    // USB Controller enable with its clock frozen until the PLL is ready
+    USBCON = (1 << USBE) | (1 << OTGPADE) | (1 << FRZCLK);
+
+    // 16MHz input divided by 2 for the PLL, then start it
+    PLLCSR = (1 << PINDIV);
+    PLLCSR |= (1 << PLLE);
+    while(!(PLLCSR & (1 << PLOCK)));
+
+    // Leave power saving mode and attach to the bus
+    USBCON &= ~(1 << FRZCLK);
+    UDCON &= ~(1 << DETACH);
+}
+
+/*!
+ * @brief (Re)configures the control endpoint after a bus reset
+ */
+static void _controlInit(void) {
+    UENUM = 0;
+    UERST = (1 << 0);
+    UERST = 0x00;
+    UECONX = (1 << EPEN);
+    // Control type, 8 byte single bank
+    UECFG0X = 0;
+    UECFG1X = (1 << ALLOC);
+    UEIENX = 0;
+}
+
+static void _processSetupPacket(uint8_t *page) {
+    uint8_t bmRequestType = UEDATX;
+    uint8_t bRequest = UEDATX;
+    uint16_t wValue = UEDATX;
+    wValue |= (UEDATX << 8);
+    uint16_t wIndex = UEDATX;
+    wIndex |= (UEDATX << 8);
+    uint16_t wLength = UEDATX;
+    wLength |= (UEDATX << 8);
+
+    // Acknowledge the setup packet
+    UEINTX &= ~(1 << RXSTPI);
+
+    // Requests are picked out with if/else rather than a switch so
+    // the compiler can't use a jump table helper from libgcc
+    if((bmRequestType & REQUEST_TYPE_MASK) == REQUEST_TYPE_STANDARD) {
+        if(bRequest == SET_ADDRESS) {
+            // Store the address, acknowledge with a ZLP, then enable it
+            UDADDR = (wValue & 0x7F);
+            _sendControlAck();
+            UDADDR |= (1 << ADDEN);
+        }
+        else if((bRequest == GET_DESCRIPTOR) && ((wValue >> 8) == DESC_DEVICE)) {
+            _sendControlData(_deviceDescriptor, sizeof(_deviceDescriptor), wLength, true);
+        }
+        else if((bRequest == GET_DESCRIPTOR) && ((wValue >> 8) == DESC_CONFIG)) {
+            _sendControlData(_configDescriptor, sizeof(_configDescriptor), wLength, true);
+        }
+        else if((bRequest == GET_DESCRIPTOR) && ((wValue >> 8) == DESC_STRING) && ((wValue & 0xFF) <= 3)) {
+            const uint8_t *desc = _languageDescriptor;
+            if((wValue & 0xFF) == 1) {
+                desc = _manufacturerStringDescriptor;
+            }
+            else if((wValue & 0xFF) == 2) {
+                desc = _productStringDescriptor;
+            }
+            else if((wValue & 0xFF) == 3) {
+                desc = _serialStringDescriptor;
+            }
+            _sendControlData(desc, pgm_read_byte(desc), wLength, true);
+        }
+        else if(bRequest == SET_CONFIGURATION) {
+            // Only the control endpoint is answered while we run, the
+            // application's endpoints are left as they are
+            _sendControlAck();
+        }
+        else if(bRequest == GET_STATUS) {
+            // Bus powered, no remote wakeup, nothing halted
+            page[0] = 0;
+            page[1] = 0;
+            _sendControlData(page, 2, wLength, false);
+        }
+        else {
+            _stallControl();
+        }
+    }
+    else if((bmRequestType & REQUEST_TYPE_MASK) == REQUEST_TYPE_VENDOR) {
+        if(bRequest == VENDOR_REQ_UPDATE_INFO) {
+            page[0] = (UPDATE_PAGE_SIZE & 0xFF);
+            page[1] = (UPDATE_PAGE_SIZE >> 8);
+            page[2] = (UPDATE_NUM_PAGES & 0xFF);
+            page[3] = (UPDATE_NUM_PAGES >> 8);
+            page[4] = UPDATE_INFO_UPDATER;
+            _sendControlData(page, UPDATE_INFO_SIZE, wLength, false);
+        }
+        else if(bRequest == VENDOR_REQ_UPDATE_HASH) {
+            // The page buffer doubles as the reply buffer
+            if((((uint32_t)wValue + wIndex) > UPDATE_NUM_PAGES) ||
+               (((uint32_t)wIndex * UPDATE_HASH_SIZE) > UPDATE_PAGE_SIZE)) {
+                _stallControl();
+                return;
+            }
+            for(uint16_t i = 0; i < wIndex; i++) {
+                uint16_t crc = _hashPage(wValue + i);
+                page[(i * UPDATE_HASH_SIZE)] = (crc & 0xFF);
+                page[(i * UPDATE_HASH_SIZE) + 1] = (crc >> 8);
+            }
+            _sendControlData(page, wIndex * UPDATE_HASH_SIZE, wLength, false);
+        }
+        else if(bRequest == VENDOR_REQ_UPDATE_WRITE) {
+            // Only whole pages of the application section can be written
+            if((wLength != UPDATE_PAGE_SIZE) || (wValue >= UPDATE_NUM_PAGES) ||
+               (_receiveControlData(page, wLength) != UPDATE_PAGE_SIZE)) {
+                _stallControl();
+                return;
+            }
+            // Any other page makes the application inconsistent until the
+            // real page 0 goes in, so make sure a reset comes back to us
+            if((wValue != 0) && !_recoveryPagePresent()) {
+                _writeRecoveryPage();
+            }
+            _writePage(wValue, page);
+            // The page is programmed before the status stage completes
+            _sendControlAck();
+        }
+        else if(bRequest == VENDOR_REQ_UPDATE_REBOOT) {
+            // The application isn't complete until page 0 has been written
+            if(_recoveryPagePresent()) {
+                _stallControl();
+                return;
+            }
+            _sendControlAck();
+
+            // Drop off the bus and let the watchdog reset us
+            UDCON |= (1 << DETACH);
+            USBCON &= ~(1 << USBE);
+            wdt_enable(WDTO_15MS);
+            while(1);
+        }
+        else {
+            _stallControl();
+        }
+    }
+    else {
+        _stallControl();
+    }
+}
+
+static void _sendControlData(const uint8_t *data, uint16_t length, const uint16_t wLength, const bool fromProgmem) {
+    // A reply shorter than the host asked for must end with a short packet,
+    // a ZLP if it is a whole number of packets
+    bool endShort = (length < wLength);
+
+    if(wLength == 0) {
+        // No data stage, just the status stage
+        _sendControlAck();
+        return;
+    }
+
+    // Never send more than the host asked for
+    if(length > wLength) {
+        length = wLength;
+    }
+
+    while(1) {
+        if(!_waitControl((1 << TXINI) | (1 << RXOUTI))) {
+            return;
+        }
+
+        // The host has moved on to the status stage
+        if(UEINTX & (1 << RXOUTI)) {
+            break;
+        }
+
+        uint8_t packetLen = ((length > CONTROL_EP_BANK_SIZE) ? CONTROL_EP_BANK_SIZE : length);
+        for(uint8_t i = 0; i < packetLen; i++) {
+            UEDATX = (fromProgmem ? pgm_read_byte(data) : *data);
+            data++;
+        }
+        length -= packetLen;
+        UEINTX &= ~(1 << TXINI);
+
+        if((length == 0) && (!endShort || (packetLen < CONTROL_EP_BANK_SIZE))) {
+            break;
+        }
+    }
+
+    // Status stage, the host acknowledges with a ZLP
+    if(_waitControl(1 << RXOUTI)) {
+        UEINTX &= ~(1 << RXOUTI);
+    }
+}
+
+static uint16_t _receiveControlData(uint8_t *data, const uint16_t length) {
+    uint16_t received = 0;
+
+    while(received < length) {
+        if(!_waitControl(1 << RXOUTI)) {
+            return 0;
+        }
+
+        uint8_t packetLen = UEBCLX;
+        for(uint8_t i = 0; i < packetLen; i++) {
+            uint8_t value = UEDATX;
+            if(received < length) {
+                data[received++] = value;
+            }
+        }
+        UEINTX &= ~(1 << RXOUTI);
+
+        // A short packet ends the data stage early
+        if(packetLen < CONTROL_EP_BANK_SIZE) {
+            break;
+        }
+    }
+
+    return received;
+}
+
+static void _sendControlAck(void) {
+    // Reply with a ZLP and wait for it to go out
+    UEINTX &= ~(1 << TXINI);
+    _waitControl(1 << TXINI);
+}
+
+static void _stallControl(void) {
+    // The hardware clears it when the next setup packet arrives
+    UECONX |= (1 << STALLRQ);
+}
+
+static bool _waitControl(const uint8_t flags) {
+    // A new setup packet or a bus reset abandons the request
+    while(!(UEINTX & flags)) {
+        if((UEINTX & (1 << RXSTPI)) || (UDINT & (1 << EORSTI))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * @brief CRC-16 of one page, same as avr-libc's _crc16_update() which
+ * isn't guaranteed to be inlined into the boot section
+ */
+static uint16_t _hashPage(const uint16_t page) {
+    uint16_t address = page * UPDATE_PAGE_SIZE;
+    uint16_t crc = 0xFFFF;
+
+    for(uint16_t i = 0; i < UPDATE_PAGE_SIZE; i++) {
+        crc ^= pgm_read_byte(address + i);
+        for(uint8_t bit = 0; bit < 8; bit++) {
+            crc = ((crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1));
+        }
+    }
+
+    return crc;
+}
+
+/*!
+ * @brief Erases, fills and writes one page
+ */
+static void _writePage(const uint16_t page, const uint8_t *data) {
+    uint16_t address = page * UPDATE_PAGE_SIZE;
+
+    boot_page_erase(address);
+    boot_spm_busy_wait();
+
+    // Load the temporary page buffer one word at a time
+    for(uint16_t i = 0; i < UPDATE_PAGE_SIZE; i += 2) {
+        uint16_t word = data[i] | (data[i + 1] << 8);
+        boot_page_fill(address + i, word);
+    }
+
+    boot_page_write(address);
+    boot_spm_busy_wait();
+
+    // Make the application section readable again for hashing
+    boot_rww_enable();
+}
+
+/*!
+ * @brief Replaces page 0 with one whose reset vector jumps to the updater.
+ * The interrupt vectors are left erased, nothing enables interrupts
+ * until the real page 0 is back.
+ */
+static void _writeRecoveryPage(void) {
+    boot_page_erase(0);
+    boot_spm_busy_wait();
+
+    for(uint16_t i = 0; i < UPDATE_PAGE_SIZE; i += 2) {
+        uint16_t word = 0xFFFF;
+        if(i == 0) {
+            word = JMP_OPCODE;
+        }
+        else if(i == 2) {
+            word = (uint16_t)(uintptr_t)updater_enter;
+        }
+        boot_page_fill(i, word);
+    }
+
+    boot_page_write(0);
+    boot_spm_busy_wait();
+    boot_rww_enable();
+}
+
+static bool _recoveryPagePresent(void) {
+    return (pgm_read_word(0) == JMP_OPCODE) &&
+           (pgm_read_word(2) == (uint16_t)(uintptr_t)updater_enter);
+}
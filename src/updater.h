@@ -0,0 +1,56 @@
+#ifndef _UPDATER_H_
+#define _UPDATER_H_
+
+#include <stdint.h>
+
+/*
+ * Firmware updater. It lives entirely in the boot loader section
+ * (BOOT_SECTION_START) and runs with interrupts disabled, polling the USB
+ * controller itself, so no application code runs while the application
+ * section is being reprogrammed. The application enters it on a
+ * VENDOR_REQ_UPDATE_REBOOT request (see update_start()).
+ *
+ * The updater is the same device to the host as the application. Entered
+ * from the application it carries on with the USB controller exactly as the
+ * application left it, same address and configuration, so the host's
+ * handle stays valid and nothing re-enumerates. Out of reset it enumerates
+ * with a copy of the application's descriptors (see usb_descriptors.h).
+ * Only the control endpoint is answered, with the update requests:
+ *
+ *  0x06 UPDATE_INFO   Control Read, returns the flash page size and page count,
+ *                     with UPDATE_INFO_UPDATER set to tell it apart from the application
+ *  0x07 UPDATE_HASH   Control Read, wValue is the first page, wIndex the page count
+ *  0x08 UPDATE_WRITE  Control Write, wValue is the page, data is the page contents
+ *  0x09 UPDATE_REBOOT Control Write, resets into the updated application. This is
+ *                     the one time the device leaves the bus.
+ *
+ * Before the first page other than page 0 is written, page 0 is replaced by
+ * a recovery page whose reset vector jumps back into the updater. An update
+ * that is interrupted part way (power loss, unplug) therefore restarts in
+ * the updater rather than in a half written application. The host writes
+ * the real page 0 last, once every other page verifies, and the reboot
+ * request is refused until it has.
+ */
+
+/*! @brief Value of updater_marker when the updater was programmed */
+#define UPDATER_MARKER          (0x5AA5)
+
+/*!
+ * @brief Linked into the boot section alongside the updater. If the
+ * application was flashed without its boot section (e.g. via DFU) this
+ * reads back as part of some other boot loader instead.
+ */
+extern const uint16_t updater_marker;
+
+/*!
+ * @brief This API starts the updater. It resets the stack, takes over the
+ * USB controller and never returns. Interrupts must be disabled before
+ * calling it.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void updater_enter(void) __attribute__((noreturn));
+
+#endif // _UPDATER_H_
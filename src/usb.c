@@ -3,10 +3,26 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include "usb.h"
+#include "usb_endpoints.h"
+#include "usb_descriptors.h"
+#include "registry.h"
+#include "update.h"
+#include "tick.h"
+#include "led.h"
+#include "work.h"
 
-#define CONTROL_EP_BANK_SIZE 8
-#define INT_IN_EP_BANK_SIZE 8
+#define CONTROL_EP_BANK_SIZE USB_CONTROL_EP_SIZE
+#define INT_IN_EP_BANK_SIZE 64
+#define BULK_EP_BANK_SIZE 64
+// Bulk OUT receive ring. Must be a power of 2 no larger than 128.
+#define BULK_OUT_RING_SIZE 128
+// Largest data stage we buffer for a vendor request (one flash page)
+#define CONTROL_BUFFER_SIZE 128
+// Most times the endpoint ISR goes round servicing endpoints before
+// it returns and lets the rest of the system run
+#define USB_ISR_MAX_PASSES 4
 
 // USB standard request codes
 #define GET_STATUS 0x00
@@ -21,6 +37,20 @@
 #define SET_INTERFACE 0x0B
 #define SYNCH_FRAME 0x0C
 
+// USB standard feature selectors
+#define FEATURE_ENDPOINT_HALT 0x00
+
+// Request recipients, bits 0-4 of bmRequestType
+#define RECIPIENT_MASK      0x1F
+#define RECIPIENT_DEVICE    0x00
+#define RECIPIENT_INTERFACE 0x01
+#define RECIPIENT_ENDPOINT  0x02
+
+// Number of interfaces in ConfigDescriptor
+#define NUM_INTERFACES 1
+// bConfigurationValue of our only configuration
+#define CONFIGURATION_VALUE 1
+
 // USB descriptor types
 #define DESC_DEVICE 1
 #define DESC_CONFIG 2
@@ -32,151 +62,170 @@
 #define DESC_STRING_PROD    2   // Product string descriptor index
 #define DESC_STRING_SERIAL  3   // Serial number string descriptor index
 
-static bool _endpoint_init(void);
+// Vendor specific request codes
+#define VENDOR_REQ_WRITE_VAR        0x01    // Control Write, wValue is passed to the write callback
+#define VENDOR_REQ_READ_VAR         0x02    // Control Read, data is provided by the read callback
+#define VENDOR_REQ_REGISTRY_READ    0x03    // Control Read, wIndex:wValue is the mask of variable ids
+#define VENDOR_REQ_REGISTRY_WRITE   0x04    // Control Write, wIndex:wValue is the mask of variable ids
+#define VENDOR_REQ_REGISTRY_INFO    0x05    // Control Read, returns the largest batch and the registry table description
+#define VENDOR_REQ_UPDATE_INFO      0x06    // Control Read, returns the flash page size and page count
+#define VENDOR_REQ_UPDATE_REBOOT    0x09    // Control Write, restarts into the boot section updater
+// 0x07 (UPDATE_HASH) and 0x08 (UPDATE_WRITE) are only answered by the updater, see updater.h
+#define VENDOR_REQ_CLOCK_SYNC       0x0A    // Control Read, returns the setup and last SOF timestamps
+#define VENDOR_REQ_LED_PATTERN      0x0B    // Control Write, wValue is the repeat count, data is the steps
+
+// Size of the VENDOR_REQ_CLOCK_SYNC reply
+#define CLOCK_SYNC_SIZE 10
+// The VENDOR_REQ_REGISTRY_INFO reply starts with the largest batch we can buffer
+#define REGISTRY_INFO_HEADER_SIZE 2
+
+static void _sendBulkBank(void);
+static bool _endpoint_init(const uint8_t first, const uint8_t last);
+static void _sendControlData(const uint8_t* data, uint16_t length, bool fromProgmem);
+static uint16_t _receiveControlData(uint8_t* data, uint16_t length);
 static void _sendDescriptor(const uint8_t* descriptor, uint16_t length);
+static void _processControlPacket(void);
 static void _processSetupPacket(void);
+static uint8_t _endpointFromIndex(const uint8_t wIndex_l);
+static void _sendControlAck(void);
+static void _stallControl(void);
 static void _processIntInPacket(void);
+static void _processBulkOutPacket(void);
+static void _processBulkInPacket(void);
+static void _controlTask(void);
+static bool _controlActive(void);
+static bool _waitControl(const uint8_t flags);
 
-// USB descriptors (example, replace with your own)
-const uint8_t PROGMEM DeviceDescriptor[] = {
-    0x12,       // bLength
-    0x01,       // bDescriptorType (Device == 1)
-    0x01, 0x01, // bcdUSB (USB 1.1 for Full Speed)
-    0x00,       // bDeviceClass (0 for composite device)
-    0x00,       // bDeviceSubClass
-    0x00,       // bDeviceProtocol
-    0x08,       // bMaxPacketSize0 (8 bytes)
-    0xad, 0xde, // idVendor (0xdead)
-    0xef, 0xbe, // idProduct (0xbeef)
-    0x01, 0x00, // bcdDevice (Device version)
-    0x01,       // iManufacturer (Index of manufacturer string descriptor)
-    0x02,       // iProduct (Index of product string descriptor)
-    0x03,       // iSerialNumber (Index of serial number string descriptor)
-    0x01        // bNumConfigurations (Number of configurations)
-};
-
-const uint8_t PROGMEM ConfigDescriptor[] = {
-    0x09,       // bLength
-    0x02,       // bDescriptorType (Configuration == 2)
-    0x19, 0x00, // wTotalLength (Total length of configuration descriptor and sub-descriptors)
-    0x01,       // bNumInterfaces (Number of interfaces in this configuration)
-    0x01,       // bConfigurationValue (Configuration value, must be 1)
-    0x00,       // iConfiguration (Index of string descriptor for this configuration)
-    0x80,       // bmAttributes (Bus-powered, no remote wakeup)
-    0xFA,       // bMaxPower (Maximum power consumption, 500mA)
-    0x09,       // bLength = 0x09, length of descriptor in bytes
-    0x04,       // bDescriptorType = 0x04, (Interface == 4)
-    0x00,       // bInterfaceNumber = 0;
-    0x00,       // bAlternateSetting = 0;
-    0x01,       // bNumEndpoints = USB_Endpoints;
-    0xFF,       // bInterfaceClass = 0xFF,
-    0xFF,       // bInterfaceSubClass = 0xFF
-    0xFF,       // bInterfaceProtocol = 0xFF
-    0x00,       // iInterface = 0, Index for string descriptor interface
-    0x07,       // bLength = 0x07, length of EP descriptor in bytes
-    0x05,       // bDescriptorType = 0x05, (Endpoint == 5)
-    0x81,       // bEndpointAddress = 0x01, (IN Endpoint addr == 1)
-    0x03,       // bmAttributes = 0x03, (Interrupt == 3)
-    0x08, 0x00, // wMaxPacketSize = 0x08, (8 bytes per packet)
-    0x20        // bInterval = 0x20, (Polling interval == 32ms for a Full-Speed interface)
-};
-
-const uint8_t PROGMEM LanguageDescriptor[] = {
-    0x04,     // bLength - Length of sting language descriptor including this byte
-    0x03,     // bDescriptorType - (String == 3)
-    0x09,0x04 // wLANGID[x] - (0x0409 = English USA)
-};
-
-const uint8_t PROGMEM ManufacturerStringDescriptor[] = {
-    24,         // bLength - Length of string descriptor (including this byte)
-    0x03,       // bDescriptorType - (String == 3)
-    'e',0x00,   // bString - Unicode Encoded String (16 Bit)
-    'v',0x00,
-    'e',0x00,
-    'r',0x00,
-    'y',0x00,
-    'd',0x00,
-    'a',0x00,
-    'y',0x00,
-    'd',0x00,
-    'e',0x00,
-    'v',0x00
-};
-
-const uint8_t PROGMEM ProductStringDescriptor[] = {
-    40,         // bLength - Length of string descriptor (including this byte)
-    0x03,       // bDescriptorType - (String == 3)
-    'a',0x00,   // bString - Unicode Encoded String (16 Bit)
-    'v',0x00,
-    'r',0x00,
-    ' ',0x00,
-    'u',0x00,
-    's',0x00,
-    'b',0x00,
-    ' ',0x00,
-    'm',0x00,
-    'a',0x00,
-    'd',0x00,
-    'e',0x00,
-    ' ',0x00,
-    's',0x00,
-    'i',0x00,
-    'm',0x00,
-    'p',0x00,
-    'l',0x00,
-    'e',0x00,
-};
-
-const uint8_t PROGMEM SerialStringDescriptor[] = {
-    0x0A,       // bLength - Length of string descriptor (including this byte)
-    0x03,       // bDescriptorType - (String == 3)
-    '2',0x00,   // bString - Unicode Encoded String (16 Bit)
-    '0',0x00,
-    '2',0x00,
-    '3',0x00
-};
+// Endpoint table. Every hardware endpoint has a line, in order. Unused endpoints are
+// EP_TYPE_DISABLED. Sizes must match the endpoint descriptors in ConfigDescriptor.
+#define ENDPOINT_TABLE(EP) \
+    /*  num type               dir         size                  banks            interrupts      handler */ \
+    EP( 0,  EP_TYPE_CONTROL,   EP_DIR_OUT, CONTROL_EP_BANK_SIZE, EP_BANKS_SINGLE, (1 << RXSTPE),  _processControlPacket) \
+    EP( 1,  EP_TYPE_INTERRUPT, EP_DIR_IN,  INT_IN_EP_BANK_SIZE,  EP_BANKS_AUTO,   (1 << TXINE),   _processIntInPacket) \
+    EP( 2,  EP_TYPE_BULK,      EP_DIR_OUT, BULK_EP_BANK_SIZE,    EP_BANKS_AUTO,   (1 << RXOUTE),  _processBulkOutPacket) \
+    EP( 3,  EP_TYPE_BULK,      EP_DIR_IN,  BULK_EP_BANK_SIZE,    EP_BANKS_AUTO,   (1 << TXINE),   _processBulkInPacket) \
+    EP( 4,  EP_TYPE_DISABLED,  0,          0,                    0,               0,              NULL) \
+    EP( 5,  EP_TYPE_DISABLED,  0,          0,                    0,               0,              NULL) \
+    EP( 6,  EP_TYPE_DISABLED,  0,          0,                    0,               0,              NULL)
 
+// Plan the DPRAM allocation and build the register values for every endpoint
+USB_ENDPOINT_PLAN(_endpoints, ENDPOINT_TABLE);
+// Endpoints the ISR services
+static const uint8_t _endpointsHandled = USB_ENDPOINT_HANDLED(ENDPOINT_TABLE);
+
+// USB descriptors, see usb_descriptors.h
+const uint8_t PROGMEM DeviceDescriptor[] = USB_DEVICE_DESCRIPTOR;
+const uint8_t PROGMEM ConfigDescriptor[] = USB_CONFIG_DESCRIPTOR;
+const uint8_t PROGMEM LanguageDescriptor[] = USB_LANGUAGE_DESCRIPTOR;
+const uint8_t PROGMEM ManufacturerStringDescriptor[] = USB_MANUFACTURER_STRING_DESCRIPTOR;
+const uint8_t PROGMEM ProductStringDescriptor[] = USB_PRODUCT_STRING_DESCRIPTOR;
+const uint8_t PROGMEM SerialStringDescriptor[] = USB_SERIAL_STRING_DESCRIPTOR;
+
+volatile usb_isr_stats_t usb_isrStats = {0};
+volatile usb_enum_stats_t usb_enumStats = {0};
+// USB_STATE_* the device is in
+volatile uint8_t _device_state = USB_STATE_POWERED;
+// Time of the last bus reset
+uint32_t _reset_micros = 0;
+// wLength of the control request being processed
+uint16_t _control_wLength = 0;
+// Set when the request being processed was cut short by a new setup
+// packet or a bus reset. Nothing more is sent for it once set.
+volatile bool _control_aborted = false;
+// Bit n is set while endpoint n is halted by SET_FEATURE(ENDPOINT_HALT)
+uint8_t _ep_halted = 0;
+// Timestamps for clock correlation with the host, all in tick_getMicros() time
+uint32_t _setup_micros = 0;         // When the current setup packet was first seen
+uint32_t _sof_micros = 0;           // Last start of frame
+uint16_t _sof_frame = 0;            // Frame number of the last start of frame
 usb_controlWrite_rx_cb_t _setupWrite_cb = NULL;
 usb_controlRead_tx_cb_t _setupRead_cb = NULL;
+// Staged interrupt IN report, only used when no endpoint bank was free
+// at the time the report was claimed. The ISR sends it once a bank frees up.
 uint8_t _interrupt_in_buffer[INT_IN_EP_BANK_SIZE] = {0x00};
-uint8_t _interrupt_in_buffer_len = 0;
+volatile uint8_t _interrupt_in_buffer_len = 0;
+// State of the report currently claimed by the application
+bool _report_claimed = false;
+bool _report_direct = false;
+uint8_t _report_len = 0;
+uint8_t _report_prevEp = 0;
+uint8_t _control_buffer[CONTROL_BUFFER_SIZE] = {0x00};
+// Bytes received on the bulk OUT endpoint. The ISR advances the head
+// and the main context advances the tail. Both are free running and
+// only wrap at 256 so their difference is always the fill level.
+uint8_t _bulk_out_ring[BULK_OUT_RING_SIZE] = {0x00};
+volatile uint8_t _bulk_out_head = 0;
+volatile uint8_t _bulk_out_tail = 0;
+// Set when the last bulk IN packet sent was full. The host can't tell the
+// transfer has ended until a short packet follows, so a ZLP is owed.
+bool _bulk_in_zlp = false;
 
 ISR(USB_GEN_vect) {
+    // Preserve the endpoint selected by the main context
+    uint8_t prevEp = UENUM;
+
     // Check if a USB reset sequence was received from the host
     if (UDINT & (1<<EORSTI)) {
         // Clear the interrupt flag
         UDINT &= ~(1<<EORSTI);
-        // Init our device endpoints
-        _endpoint_init();
-        // Enable our Setup RX interrupt. This causes
-        // an ISR to fire when a Setup packet is received
-        UEIENX |= (1<<RXSTPE);
+        // Drop any partially received commands
+        _bulk_out_tail = _bulk_out_head;
+        _bulk_in_zlp = false;
+        // and any staged report
+        _interrupt_in_buffer_len = 0;
+        // A reset returns us to the default state, at address 0
+        _device_state = USB_STATE_DEFAULT;
+        _ep_halted = 0;
+        // Start timing the enumeration
+        _reset_micros = tick_getMicros();
+        usb_enumStats.resets++;
+        usb_enumStats.micros = 0;
+        usb_enumStats.requests = 0;
+        usb_enumStats.stalls = 0;
+        // Abandon any request the control worker is in the middle of
+        _control_aborted = true;
+        // Only the control endpoint is used until the
+        // host selects our configuration
+        _endpoint_init(0, 0);
     }
+
+    // Timestamp every start of frame for clock sync
+    if (UDINT & (1<<SOFI)) {
+        UDINT &= ~(1<<SOFI);
+        _sof_micros = tick_getMicros();
+        _sof_frame = UDFNUM & 0x07FF;
+    }
+
+    UENUM = prevEp;
 }
 
 ISR(USB_COM_vect) {
-    // Check which endpoint caused the interrupt
-    switch (UEINT) {
-        case (1<<EPINT0):
-            // Select EP 0 before checking the interrupt register
-            UENUM = 0;
-            // Check if we received a Setup packet
-            if (UEINTX & (1<<RXSTPI)) {
-                // Handle the setup packet
-                _processSetupPacket();
-            }
-            break;
+    // Preserve the endpoint selected by the main context
+    uint8_t prevEp = UENUM;
+    uint32_t start = tick_getMicros();
+    uint8_t pending;
+    uint8_t passes = 0;
 
-        case (1<<EPINT1):
-            // Select EP 1 before checking the interrupt register
-            UENUM = 1;
-            // Handle the IN packet request
-            _processIntInPacket();
-            break;
+    usb_isrStats.entries++;
 
-        default:
-            break;
+    // Service every pending endpoint, then look again. Endpoints that
+    // become ready while we work are handled without another ISR entry.
+    while((passes++ < USB_ISR_MAX_PASSES) && (pending = (UEINT & _endpointsHandled))) {
+        USB_ENDPOINT_DISPATCH(ENDPOINT_TABLE, pending, usb_isrStats.events);
+    }
+
+    // Anything still pending fires the ISR again as soon as we return
+    if(UEINT & _endpointsHandled) {
+        usb_isrStats.reentries++;
     }
+
+    uint32_t elapsed = tick_getMicros() - start;
+    usb_isrStats.busyMicros += elapsed;
+    if(elapsed > usb_isrStats.maxMicros) {
+        usb_isrStats.maxMicros = (elapsed > UINT16_MAX) ? UINT16_MAX : elapsed;
+    }
+
+    UENUM = prevEp;
 }
 
 void usb_init(usb_controlWrite_rx_cb_t onControlWriteCb, usb_controlRead_tx_cb_t onControlReadCb) {
@@ -215,6 +264,9 @@ void usb_init(usb_controlWrite_rx_cb_t onControlWriteCb, usb_controlRead_tx_cb_t
         _setupRead_cb = onControlReadCb;
     }
 
+    // Setup packets are handled by a worker in the main loop
+    work_register(WORK_USB_CONTROL, _controlTask);
+
     // Attach the device by clearing the detach bit
     // This is acceptable in the case of a bus-powered device
     // otherwise you would initiate this step based on a
@@ -226,64 +278,312 @@ void usb_init(usb_controlWrite_rx_cb_t onControlWriteCb, usb_controlRead_tx_cb_t
     // USB enumeration. Init of the USB will continue in the
     // ISRs when the reset signal is received.
     UDIEN |= (1 << EORSTE);
+    // Enable the start of frame IRQ. Each SOF is timestamped
+    // so the host can correlate our clock with its own.
+    UDIEN |= (1 << SOFE);
+}
+
+uint8_t usb_getState(void) {
+    return _device_state;
 }
 
 uint16_t usb_sendInterruptData(const uint8_t *data, const uint16_t len) {
-    if(len < INT_IN_EP_BANK_SIZE) {
-        memcpy(_interrupt_in_buffer, data, len);
-        _interrupt_in_buffer_len = len;
-        return len;
+    if((len > INT_IN_EP_BANK_SIZE) || !usb_reportClaim()) {
+        return 0;
+    }
+
+    for(uint8_t i = 0; i < len; i++) {
+        usb_reportWrite(data[i]);
     }
+    usb_reportCommit();
 
-    return 0;
+    return len;
 }
 
-static bool _endpoint_init(void) {
-    // Select Endpoint 0
-    UENUM = 0x00;
-    // Reset the endpoint fifo
-    UERST = 0x7F;
-    UERST = 0x00;
-    // Enable the endpoint
-    UECONX |= (1 << EPEN);
-    // Configure endpoint as Control with OUT direction
-    UECFG0X = 0;
-    // Configure endpoint size
-    UECFG1X = 0x00;
-    // Allocate the endpoint buffers
-    UECFG1X |= (1 << ALLOC);
-    // Enable the endpoint interrupt
-    UEIENX |= (1 << RXSTPE) | (1 << RXOUTE);
-    // Check if endpoint configuration is ok
-    if(!(UESTA0X & (1 << CFGOK))) {
+bool usb_reportReady(void) {
+    bool ready;
+
+    if(_report_claimed) {
         return false;
     }
 
-    // Select Endpoint 1
-    UENUM = 0x01;
-    // Reset the endpoint fifo
-    UERST = 0x7F;
-    UERST = 0x00;
-    // Enable the endpoint
-    UECONX |= (1 << EPEN);
-    // Configure endpoint as Interrupt with IN direction
-    UECFG0X = (1 << EPTYPE1) | (1 << EPTYPE0) | (1 << EPDIR);
-    // Configure endpoint size
-    UECFG1X = 0x00;
-    // Allocate the endpoint buffers
-    UECFG1X |= (1 << ALLOC);
-    // Enable the endpoint interrupt
-    UEIENX |= (1 << NAKINE) | (1 << RXOUTE);
-    // Check if endpoint configuration is ok
-    return((UESTA0X & (1 << CFGOK)));
+    uint8_t prevEp = UENUM;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        UENUM = 1;
+        // Configured, with a free bank and nothing staged ahead of us
+        ready = (UECONX & (1 << EPEN)) && (UEINTX & (1 << RWAL)) && !_interrupt_in_buffer_len;
+        // Otherwise have the ISR post WORK_USB_INT_IN once a bank frees up
+        if(!ready && (UECONX & (1 << EPEN))) {
+            UEIENX |= (1 << TXINE);
+        }
+        UENUM = prevEp;
+    }
+
+    return ready;
 }
 
-static void _sendDescriptor(const uint8_t* descriptor, uint16_t length) {
+bool usb_reportClaim(void) {
+    bool claimed = false;
+
+    if(_report_claimed) {
+        return false;
+    }
+
+    _report_prevEp = UENUM;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        UENUM = 1;
+
+        // Nothing to send until the host has configured us
+        if(UECONX & (1 << EPEN)) {
+            // Write straight into the FIFO if a bank is free. A staged report
+            // is older than anything we claim now, so it has to go first.
+            _report_direct = (UEINTX & (1 << RWAL)) && !_interrupt_in_buffer_len;
+
+            if(!_report_direct) {
+                // Stop the ISR from sending the staged report
+                // while we overwrite it with a newer one
+                UEIENX &= ~(1 << TXINE);
+                _interrupt_in_buffer_len = 0;
+            }
+
+            _report_len = 0;
+            _report_claimed = true;
+            claimed = true;
+        }
+    }
+
+    // Leave EP 1 selected for the writes that follow. The ISRs
+    // restore UENUM so it can't change underneath us.
+    if(!claimed) {
+        UENUM = _report_prevEp;
+    }
+
+    return claimed;
+}
+
+void usb_reportWrite(const uint8_t byte) {
+    // Anything past the endpoint size is dropped
+    if(!_report_claimed || (_report_len >= INT_IN_EP_BANK_SIZE)) {
+        return;
+    }
+
+    if(_report_direct) {
+        UEDATX = byte;
+    }
+    else {
+        _interrupt_in_buffer[_report_len] = byte;
+    }
+    _report_len++;
+}
+
+void usb_reportCommit(void) {
+    if(!_report_claimed) {
+        return;
+    }
+
+    if(_report_direct) {
+        // Clear TXINI then FIFOCON to hand the bank to the hardware
+        UEINTX &= ~(1 << TXINI);
+        UEINTX &= ~(1 << FIFOCON);
+    }
+    else {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            // Have the ISR send the staged report as soon as a bank is free
+            _interrupt_in_buffer_len = _report_len;
+            UEIENX |= (1 << TXINE);
+        }
+    }
+
+    _report_claimed = false;
+    UENUM = _report_prevEp;
+}
+
+uint16_t usb_bulkAvailable(void) {
+    return (uint8_t)(_bulk_out_head - _bulk_out_tail);
+}
+
+uint16_t usb_bulkPeek(uint8_t *data, const uint16_t len) {
+    uint8_t tail = _bulk_out_tail;
+
+    if(usb_bulkAvailable() < len) {
+        return 0;
+    }
+
+    for(uint16_t i = 0; i < len; i++) {
+        data[i] = _bulk_out_ring[(tail++) & (BULK_OUT_RING_SIZE - 1)];
+    }
+
+    return len;
+}
+
+uint16_t usb_bulkRead(uint8_t *data, const uint16_t len) {
+    if(!usb_bulkPeek(data, len)) {
+        return 0;
+    }
+
+    // Consume the bytes
+    _bulk_out_tail += len;
+
+    // If the ISR had to leave a packet in the bank because we were
+    // full, re-enable the OUT interrupt now that it may fit.
+    if((BULK_OUT_RING_SIZE - usb_bulkAvailable()) >= BULK_EP_BANK_SIZE) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            uint8_t prevEp = UENUM;
+            UENUM = 2;
+            UEIENX |= (1 << RXOUTE);
+            UENUM = prevEp;
+        }
+    }
+
+    return len;
+}
+
+bool usb_bulkWrite(const uint8_t *data, const uint16_t len) {
+    bool queued = false;
+
+    if(len > BULK_EP_BANK_SIZE) {
+        return false;
+    }
+
+    uint8_t prevEp = UENUM;
+    UENUM = 3;
+
+    // Writes are never split across packets. If there isn't room left
+    // in the current bank send it and move on to the next one. A bank
+    // that filled up exactly has RWAL clear but FIFOCON still set, it's
+    // ours until it is sent, so check FIFOCON rather than RWAL.
+    if((UEINTX & (1 << FIFOCON)) && UEBCLX && ((UEBCLX + len) > BULK_EP_BANK_SIZE)) {
+        _sendBulkBank();
+    }
+
+    // Only write if we have a bank we can fill
+    if(UEINTX & (1 << RWAL)) {
+        for(uint16_t i = 0; i < len; i++) {
+            UEDATX = data[i];
+        }
+        queued = true;
+
+        // Nothing more fits, send it now rather than hold it
+        if(UEBCLX == BULK_EP_BANK_SIZE) {
+            _sendBulkBank();
+        }
+    }
+    else {
+        // Have the ISR post WORK_USB_BULK once the host takes a bank
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            UEIENX |= (1 << TXINE);
+        }
+    }
+
+    UENUM = prevEp;
+
+    return queued;
+}
+
+void usb_bulkFlush(void) {
+    uint8_t prevEp = UENUM;
+    UENUM = 3;
+
+    // Send the current bank if it holds anything, full or not. If the last
+    // packet was full end the transfer with a ZLP, otherwise the host keeps
+    // waiting for more data. No bank for it yet? Come back when there is.
+    if(UEBCLX || _bulk_in_zlp) {
+        if(UEINTX & (1 << FIFOCON)) {
+            _sendBulkBank();
+        }
+        else {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                UEIENX |= (1 << TXINE);
+            }
+        }
+    }
+
+    UENUM = prevEp;
+}
+
+/*!
+ * @brief Hands the current bulk IN bank to the host. UENUM must already
+ * select the bulk IN endpoint.
+ */
+static void _sendBulkBank(void) {
+    // A full packet doesn't end the transfer, usb_bulkFlush() owes a ZLP
+    _bulk_in_zlp = (UEBCLX == BULK_EP_BANK_SIZE);
+
+    // Clear TXINI then FIFOCON to send the bank
+    UEINTX &= ~(1 << TXINI);
+    UEINTX &= ~(1 << FIFOCON);
+}
+
+static bool _endpoint_init(const uint8_t first, const uint8_t last) {
+    bool ok = true;
+
+    // Endpoints are allocated in ascending order, so freeing one invalidates
+    // every endpoint above it. Free from the top down to the first endpoint
+    // we are (re)configuring.
+    for(int8_t ep = USB_NUM_ENDPOINTS - 1; ep >= first; ep--) {
+        UENUM = ep;
+        // Disable the endpoint
+        UECONX &= ~(1 << EPEN);
+        // Release its memory
+        UECFG1X &= ~(1 << ALLOC);
+    }
+
+    // Then allocate them again in ascending order from the table
+    for(uint8_t ep = first; ep <= last; ep++) {
+        uint8_t cfg0 = pgm_read_byte(&_endpoints[ep].cfg0);
+
+        if(cfg0 == 0xFF) {
+            // Unused endpoint
+            continue;
+        }
+
+        // Select the endpoint
+        UENUM = ep;
+        // Reset the endpoint fifo
+        UERST = (1 << ep);
+        UERST = 0x00;
+        // Enable the endpoint
+        UECONX |= (1 << EPEN);
+        // Configure the endpoint type and direction
+        UECFG0X = cfg0;
+        // Configure the endpoint size, bank count and allocate its buffers
+        UECFG1X = pgm_read_byte(&_endpoints[ep].cfg1);
+        // Enable the endpoint interrupts
+        UEIENX = pgm_read_byte(&_endpoints[ep].interrupts);
+        // Check if endpoint configuration is ok
+        if(!(UESTA0X & (1 << CFGOK))) {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void _sendControlData(const uint8_t* data, uint16_t length, bool fromProgmem) {
     // See section 22.12.2 of https://ww1.microchip.com/downloads/en/devicedoc/atmel-7766-8-bit-avr-atmega16u4-32u4_datasheet.pdf
     // for an illustration of the "Control Read" process. Specifically the "DATA" and "STATUS"
     // portion of the timing diagram are handled here.
 
-    // We are going to chunk the descriptor into 8 byte packets. Looping until we have finished
+    // The host may have given up while we were preparing the data
+    if(!_controlActive()) {
+        return;
+    }
+
+    // A Control Read with wLength 0 has no data stage. The host goes
+    // straight to the status stage and waits for our ZLP, there is no
+    // OUT packet from it to wait for.
+    if(_control_wLength == 0) {
+        _sendControlAck();
+        return;
+    }
+
+    // Never send more than the host asked for
+    if(length > _control_wLength) {
+        length = _control_wLength;
+    }
+
+    // We are going to chunk the data into 8 byte packets. Looping until we have finished
     for(uint16_t i = 1; i <= length; i++) {
         if(UEINTX & (1 << RXOUTI)) {
             // We received an OUT packet which means
@@ -293,31 +593,152 @@ static void _sendDescriptor(const uint8_t* descriptor, uint16_t length) {
             return;
         }
 
-        // Load the next byte from our descriptor
-        UEDATX = pgm_read_byte(&descriptor[i-1]);
+        // Load the next byte from our data
+        UEDATX = (fromProgmem ? pgm_read_byte(&data[i-1]) : data[i-1]);
         // If our packet is full
         if(((i%8) == 0)) {
             // Clear the TXINI bit to initiate the transfer
             UEINTX &= ~(1 << TXINI);
             // Wait for transmission to complete (TXINI set) or
             // the HOST to abort (RXOUTI set)
-            while (!(UEINTX & ((1 << RXOUTI) | (1<<TXINI))));
+            if(!_waitControl((1 << RXOUTI) | (1 << TXINI))) {
+                return;
+            }
         }
     }
     // Go ahead and transmit the remaining data (if there is any) if the HOST
     // hasn't asked us to abort
     if((!(UEINTX & (1 << RXOUTI)))) {
-        // Clear the TXINI bit to initiate the transfer
-        // to send the remaining data we may have queued up
-        UEINTX &= ~(1 << TXINI);
+        // Clear the TXINI bit to initiate the transfer to send the remaining data
+        // we may have queued up. If the last packet was full and the host asked for
+        // more, this sends the ZLP that tells it we have nothing else.
+        if((length % CONTROL_EP_BANK_SIZE) || (length < _control_wLength)) {
+            UEINTX &= ~(1 << TXINI);
+        }
         // Wait for the ACK back from the host (RXOUTI set)
-        while (!(UEINTX & (1 << RXOUTI)));
+        if(!_waitControl(1 << RXOUTI)) {
+            return;
+        }
     }
 
     // Clear the RXOUTI bit to acknowledge the packet
     UEINTX &= ~(1 << RXOUTI);
 }
 
+static uint16_t _receiveControlData(uint8_t* data, uint16_t length) {
+    // See section 22.12.1 of the datasheet for the "Control Write" process. This
+    // handles the "DATA" portion, the caller is responsible for the "STATUS" stage.
+    uint16_t rxLen = 0;
+
+    while(rxLen < length) {
+        // Wait for the next OUT data packet from the host
+        if(!_waitControl(1 << RXOUTI)) {
+            break;
+        }
+
+        // Read out the bytes the host sent in this packet
+        uint8_t packetLen = UEBCLX;
+        for(uint8_t i = 0; (i < packetLen) && (rxLen < length); i++) {
+            data[rxLen++] = UEDATX;
+        }
+
+        // Clear the RXOUTI bit to acknowledge the packet and free the bank
+        UEINTX &= ~(1 << RXOUTI);
+
+        // A short packet ends the data stage early
+        if(packetLen < CONTROL_EP_BANK_SIZE) {
+            break;
+        }
+    }
+
+    return rxLen;
+}
+
+static void _stallControl(void) {
+    // A request that was cut short gets no reply, a STALL now
+    // would land on the request that replaced it
+    if(!_controlActive()) {
+        return;
+    }
+
+    // Reply to the request with a STALL. The hardware clears
+    // it when the next setup packet arrives.
+    UECONX |= (1 << STALLRQ);
+
+    if(_device_state != USB_STATE_CONFIGURED) {
+        usb_enumStats.stalls++;
+    }
+}
+
+static void _sendControlAck(void) {
+    if(!_controlActive()) {
+        return;
+    }
+
+    // Reply to a request without a data stage with a ZLP
+    UEINTX &= ~(1 << TXINI);
+    // Wait for the bank to become ready again
+    _waitControl(1 << TXINI);
+}
+
+static bool _controlActive(void) {
+    // A new setup packet replaces the request we are working on
+    if(UEINTX & (1 << RXSTPI)) {
+        _control_aborted = true;
+    }
+
+    return !_control_aborted;
+}
+
+static bool _waitControl(const uint8_t flags) {
+    // The control worker runs in the main loop, so the host can start a new
+    // request or reset the bus while we wait on this one. Give up on it if so.
+    while(!(UEINTX & flags)) {
+        if(_control_aborted || (UEINTX & (1 << RXSTPI))) {
+            _control_aborted = true;
+            return false;
+        }
+
+        // Let the streaming endpoints carry on while the host takes its
+        // time. Their workers select other endpoints, make sure we get
+        // EP0 back whatever they leave selected.
+        uint8_t ep = UENUM;
+        work_yield();
+        UENUM = ep;
+    }
+
+    return true;
+}
+
+static uint8_t _endpointFromIndex(const uint8_t wIndex_l) {
+    // wIndex holds the endpoint address, direction in bit 7. Returns
+    // the endpoint number, or 0xFF if there is no such endpoint.
+    uint8_t ep = wIndex_l & 0x0F;
+
+    if((wIndex_l & 0x70) || (ep >= USB_NUM_ENDPOINTS)) {
+        return 0xFF;
+    }
+
+    // The control endpoint is addressable in either direction
+    if(ep == 0) {
+        return 0;
+    }
+
+    // Other endpoints only exist once configured, and only in their own direction
+    uint8_t cfg0 = pgm_read_byte(&_endpoints[ep].cfg0);
+    if((_device_state != USB_STATE_CONFIGURED) || (cfg0 == 0xFF) ||
+       (((cfg0 & EP_DIR_IN) != 0) != ((wIndex_l & 0x80) != 0))) {
+        return 0xFF;
+    }
+
+    return ep;
+}
+
+static void _sendDescriptor(const uint8_t* descriptor, uint16_t length) {
+    // Descriptors live in flash
+    _sendControlData(descriptor, length, true);
+}
+
 static void  _processSetupPacket(void) {
     // Read the 8 bytes from the setup packet. Depending on the type of request
     // each value may have a different use/meaning. Reference "The SETUP Packet" section
@@ -334,24 +755,99 @@ static void  _processSetupPacket(void) {
     uint16_t descriptorLength = 0;
     uint16_t wLength = wLength_l | (wLength_h << 8);
     uint16_t wValue = wValue_l | (wValue_h << 8);
+    uint16_t wIndex = wIndex_l | (wIndex_h << 8);
+    uint16_t dataLength = 0;
+    uint8_t endpoint = 0;
     uint8_t _setup_read_buff[CONTROL_EP_BANK_SIZE] = {0x00};
 
     // Ack the received setup package by clearing the RXSTPI bit
     UEINTX &= ~(1 << RXSTPI);
 
+    // Data we send is never longer than the host asked for
+    _control_wLength = wLength;
+
+    if(_device_state != USB_STATE_CONFIGURED) {
+        usb_enumStats.requests++;
+    }
+
     if ((bmRequestType & 0x60) == 0) { // Standard request type
         switch (bRequest) {
             case GET_STATUS:
-                // Reply with 16 bits for our status. We are self powered, no remote-wakeup
-                // and we are not halted.
-                UEDATX = 0;
-                UEDATX = 0;
-                // Clear the TXINI bit to initiate the transfer
-                UEINTX &= ~(1 << TXINI);
-                // Wait for ZLP from host
-                while (!(UEINTX & (1 << RXOUTI)));
-                // Clear the RXOUTI bit to acknowledge the packet
-                UEINTX &= ~(1 << RXOUTI);
+                // Reply with 16 bits of status for the recipient
+                _control_buffer[0] = 0;
+                _control_buffer[1] = 0;
+                switch(bmRequestType & RECIPIENT_MASK) {
+                    case RECIPIENT_DEVICE:
+                        // We are bus powered with no remote-wakeup, all zeros
+                        break;
+
+                    case RECIPIENT_INTERFACE:
+                        // Interface status is reserved, but the interface must exist
+                        if((_device_state != USB_STATE_CONFIGURED) || (wIndex_l >= NUM_INTERFACES)) {
+                            _stallControl();
+                            return;
+                        }
+                        break;
+
+                    case RECIPIENT_ENDPOINT:
+                        endpoint = _endpointFromIndex(wIndex_l);
+                        if(endpoint == 0xFF) {
+                            _stallControl();
+                            return;
+                        }
+                        // Bit 0 is the halt feature
+                        _control_buffer[0] = ((_ep_halted >> endpoint) & 0x01);
+                        break;
+
+                    default:
+                        _stallControl();
+                        return;
+                }
+                _sendControlData(_control_buffer, (wLength < 2 ? wLength : 2), false);
+                break;
+
+            case CLEAR_FEATURE:
+            case SET_FEATURE:
+                // ENDPOINT_HALT is the only feature we support
+                endpoint = _endpointFromIndex(wIndex_l);
+                if(((bmRequestType & RECIPIENT_MASK) != RECIPIENT_ENDPOINT) ||
+                   (wValue != FEATURE_ENDPOINT_HALT) || (endpoint == 0xFF)) {
+                    _stallControl();
+                    break;
+                }
+
+                // Halting the control endpoint isn't meaningful, just acknowledge it.
+                // We run in the main loop, keep the endpoint ISR out while we change it.
+                if(endpoint != 0) {
+                    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                        UENUM = endpoint;
+                        if(bRequest == SET_FEATURE) {
+                            // STALL every transaction until the host clears the halt
+                            UECONX |= (1 << STALLRQ);
+                            _ep_halted |= (1 << endpoint);
+                        }
+                        else {
+                            // Stop stalling, throw away anything left in the FIFO and restart
+                            // the data toggle at DATA0. This is done even if the endpoint wasn't
+                            // halted, the host expects the toggle reset either way.
+                            UECONX |= (1 << STALLRQC);
+                            UERST = (1 << endpoint);
+                            UERST = 0x00;
+                            UECONX |= (1 << RSTDT);
+                            _ep_halted &= ~(1 << endpoint);
+                            // The reset discarded a staged report's bank, if any
+                            if(endpoint == 1) {
+                                _interrupt_in_buffer_len = 0;
+                            }
+                            // Back to the table's interrupts, so the workers of the
+                            // IN endpoints are woken now their banks are free
+                            UEIENX = pgm_read_byte(&_endpoints[endpoint].interrupts);
+                        }
+                        UENUM = 0;
+                    }
+                }
+
+                _sendControlAck();
                 break;
 
             case SET_ADDRESS:
@@ -361,9 +857,13 @@ static void  _processSetupPacket(void) {
                 // Device should then respond with a ZLP to acknowledge the request
                 UEINTX &= ~(1 << TXINI);
                 // Wait for the bank to become ready again (TIXINI set)
-                while (!(UEINTX & (1<<TXINI)));
+                if(!_waitControl(1 << TXINI)) {
+                    break;
+                }
                 // After sending the ZLP, the device should apply the address by setting the ADDEN bit
                 UDADDR |= (1 << ADDEN);
+                // Address 0 takes us back to the default state
+                _device_state = ((wValue_l & 0x7F) ? USB_STATE_ADDRESS : USB_STATE_DEFAULT);
                 break;
 
             case GET_DESCRIPTOR:
@@ -381,7 +881,9 @@ static void  _processSetupPacket(void) {
                         // 9 to determine how many interfaces are available.
                         // However, once the host determines how many interfaces are available it will then
                         // do another Config descriptor read with the full length of the descriptor.
-                        descriptorLength = wLength_l + (wLength_h << 8);
+                        // wTotalLength is the length of all of it, _sendControlData() cuts
+                        // it short if the host asked for less.
+                        descriptorLength = pgm_read_byte(&ConfigDescriptor[2]) | (pgm_read_byte(&ConfigDescriptor[3]) << 8);
                         // Send the descriptor with the requested length
                         _sendDescriptor((uint8_t*)ConfigDescriptor, descriptorLength);
                         break;
@@ -421,51 +923,107 @@ static void  _processSetupPacket(void) {
                                 break;
 
                             default:
+                                // No such string, let the host know straight away
+                                _stallControl();
                                 break;
                         }
                         break;
 
                     default:
+                        // Unsupported descriptor type (e.g. device qualifier)
+                        _stallControl();
                         break;
                 }
                 break;
 
+            case GET_CONFIGURATION:
+                _control_buffer[0] = ((_device_state == USB_STATE_CONFIGURED) ? CONFIGURATION_VALUE : 0);
+                _sendControlData(_control_buffer, 1, false);
+                break;
+
+            case GET_INTERFACE:
+                // Our only interface has just the one alternate setting
+                if((_device_state != USB_STATE_CONFIGURED) || (wIndex_l >= NUM_INTERFACES)) {
+                    _stallControl();
+                    break;
+                }
+                _control_buffer[0] = 0;
+                _sendControlData(_control_buffer, 1, false);
+                break;
+
+            case SET_INTERFACE:
+                if((_device_state != USB_STATE_CONFIGURED) || (wIndex_l >= NUM_INTERFACES) || (wValue != 0)) {
+                    _stallControl();
+                    break;
+                }
+                // Selecting the alternate setting resets the interface's endpoints,
+                // including their data toggles and any halt
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    _bulk_out_tail = _bulk_out_head;
+                    _bulk_in_zlp = false;
+                    _interrupt_in_buffer_len = 0;
+                    _endpoint_init(1, (USB_NUM_ENDPOINTS - 1));
+                    _ep_halted = 0;
+                    UENUM = 0;
+                }
+                _sendControlAck();
+                break;
+
             case SET_CONFIGURATION:
-                // Select EP 0
-                UENUM = 0;
+                // Only valid once addressed, and only for configurations we have
+                if((_device_state == USB_STATE_DEFAULT) || ((wValue != 0) && (wValue != CONFIGURATION_VALUE))) {
+                    _stallControl();
+                    break;
+                }
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    // Drop any partially received commands and staged reports
+                    _bulk_out_tail = _bulk_out_head;
+                    _bulk_in_zlp = false;
+                    _interrupt_in_buffer_len = 0;
+                    // (Re)configure the rest of our endpoints from the table. Configuration 0
+                    // returns the device to the addressed state with only EP 0 enabled.
+                    _endpoint_init(1, (wValue_l ? (USB_NUM_ENDPOINTS - 1) : 0));
+                    _ep_halted = 0;
+                    UENUM = 0;
+                }
+                // Record how long it took to get here from the bus reset
+                if(wValue && (_device_state != USB_STATE_CONFIGURED)) {
+                    usb_enumStats.micros = tick_getMicros() - _reset_micros;
+                }
+                _device_state = (wValue ? USB_STATE_CONFIGURED : USB_STATE_ADDRESS);
                 // Reply with a ZLP to acknowledge the request
-                UEINTX &= ~(1 << TXINI);
-                // Wait for the bank to be ready again
-                while (!(UEINTX & (1<<TXINI)));
+                _sendControlAck();
                 break;
 
             default:
                 // Invalid request was sent. Reply with a STALl
-                UECONX |= (1 << STALLRQ);
+                _stallControl();
                 break;
         }
     }
     else if((bmRequestType & 0x60) == 0x40) { // Vendor specific request type
         switch(bRequest) {
-            case 0x01:
+            case VENDOR_REQ_WRITE_VAR:
                 // If we have a callback stored, call it with the value
                 if(_setupWrite_cb != NULL) {
                     _setupWrite_cb(wValue);
                 }
 
                 // Reply with a ZLP
-                UEINTX &= ~(1 << TXINI);
-                // Wait for the bank to become ready again
-                while (!(UEINTX & (1<<TXINI)));
+                _sendControlAck();
                 break;
 
-            case 0x02:
+            case VENDOR_REQ_READ_VAR:
                 if(_setupRead_cb != NULL) {
                     // Call our callback to get the data to send back
                     uint16_t txLen = _setupRead_cb(_setup_read_buff,
                         (wLength > CONTROL_EP_BANK_SIZE ?
                             CONTROL_EP_BANK_SIZE :
                             wLength));
+                    // The host may have given up on a slow callback
+                    if(!_controlActive()) {
+                        break;
+                    }
                     // Send the data back to the host
                     for(uint16_t i = 0; i < txLen; i++) {
                         UEDATX = _setup_read_buff[i];
@@ -473,51 +1031,215 @@ static void  _processSetupPacket(void) {
                     // Clear the TXINI bit to initiate the transfer
                     UEINTX &= ~(1 << TXINI);
                     // Wait for the bank to become ready again
-                    while (!(UEINTX & (1<<TXINI)));
+                    _waitControl(1 << TXINI);
                 }
                 else {
                     // No callbakc was provided so
                     // reply with a stall
-                    UECONX |= (1 << STALLRQ);
+                    _stallControl();
+                }
+                break;
+
+            case VENDOR_REQ_REGISTRY_READ:
+                // Pack every variable selected by the 32 bit mask into our buffer. Some
+                // are updated by ISRs, so take them all in one go.
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    dataLength = registry_read((uint32_t)wValue | ((uint32_t)wIndex << 16), _control_buffer,
+                        (wLength > CONTROL_BUFFER_SIZE ?
+                            CONTROL_BUFFER_SIZE :
+                            wLength));
+                }
+                if(dataLength) {
+                    // Send all of the values back in one transfer
+                    _sendControlData(_control_buffer, dataLength, false);
+                }
+                else {
+                    // Unknown or unreadable id, or the values don't fit. Reply with a STALL
+                    _stallControl();
+                }
+                break;
+
+            case VENDOR_REQ_REGISTRY_WRITE:
+                if(wLength > CONTROL_BUFFER_SIZE) {
+                    // We can't buffer the data stage. Reply with a STALL
+                    _stallControl();
+                    break;
+                }
+                // Receive the packed values from the data stage
+                dataLength = _receiveControlData(_control_buffer, wLength);
+                if(_control_aborted) {
+                    // Don't act on part of the data
+                    break;
+                }
+                if(registry_write((uint32_t)wValue | ((uint32_t)wIndex << 16), _control_buffer, dataLength)) {
+                    // Reply with a ZLP to complete the status stage
+                    _sendControlAck();
+                }
+                else {
+                    // Nothing was written. Fail the status stage with a STALL
+                    _stallControl();
+                }
+                break;
+
+            case VENDOR_REQ_LED_PATTERN:
+                if(wLength > (LED_MAX_STEPS * LED_STEP_SIZE)) {
+                    // Too many steps. Reply with a STALL
+                    _stallControl();
+                    break;
+                }
+                // Receive the whole pattern table from the data stage
+                dataLength = _receiveControlData(_control_buffer, wLength);
+                if(_control_aborted) {
+                    break;
+                }
+                if(led_setPattern(_control_buffer, dataLength, wValue_l)) {
+                    _sendControlAck();
+                }
+                else {
+                    // Not a whole number of steps. Fail the status stage with a STALL
+                    _stallControl();
+                }
+                break;
+
+            case VENDOR_REQ_REGISTRY_INFO:
+                // Tell the host how large a batch can be, then describe the registry
+                // table so it can encode and decode batches
+                _control_buffer[0] = CONTROL_BUFFER_SIZE & 0xFF;
+                _control_buffer[1] = CONTROL_BUFFER_SIZE >> 8;
+                dataLength = REGISTRY_INFO_HEADER_SIZE + registry_describe(&_control_buffer[REGISTRY_INFO_HEADER_SIZE],
+                    CONTROL_BUFFER_SIZE - REGISTRY_INFO_HEADER_SIZE);
+                _sendControlData(_control_buffer, dataLength, false);
+                break;
+
+            case VENDOR_REQ_CLOCK_SYNC:
+                // Setup timestamp, then last SOF timestamp and frame number, little endian.
+                // The SOF ISR keeps updating the last two.
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    memcpy(&_control_buffer[0], &_setup_micros, sizeof(_setup_micros));
+                    memcpy(&_control_buffer[4], &_sof_micros, sizeof(_sof_micros));
+                    memcpy(&_control_buffer[8], &_sof_frame, sizeof(_sof_frame));
                 }
+                _sendControlData(_control_buffer, (wLength < CLOCK_SYNC_SIZE ? wLength : CLOCK_SYNC_SIZE), false);
+                break;
+
+            case VENDOR_REQ_UPDATE_INFO:
+                dataLength = update_info(_control_buffer);
+                _sendControlData(_control_buffer, (wLength < dataLength ? wLength : dataLength), false);
+                break;
+
+            case VENDOR_REQ_UPDATE_REBOOT:
+                // Complete the request before we hand over. The updater
+                // takes it from here and never comes back.
+                _sendControlAck();
+                update_start();
                 break;
 
             default:
                 // Unsupported vendor specific request. Reply with a STALL
-                UECONX |= (1 << STALLRQ);
+                _stallControl();
                 break;
         }
     }
     else { // Invalid request type
         // Reply with a STALL
-        UECONX |= (1 << STALLRQ);
+        _stallControl();
+    }
+}
+
+static void _processControlPacket(void) {
+    // Check if we received a Setup packet
+    if (UEINTX & (1<<RXSTPI)) {
+        // Stamp it as soon as we see it. An earlier ISR entry time
+        // could predate the packet when the ISR loops over endpoints.
+        _setup_micros = tick_getMicros();
+        // Leave it in the bank for the control worker. The hardware NAKs the rest
+        // of the transfer until RXSTPI is cleared, so the host just waits. Stop
+        // listening for setup packets until the worker is done with this one.
+        UEIENX &= ~(1 << RXSTPE);
+        work_post(WORK_USB_CONTROL);
+    }
+}
+
+static void _controlTask(void) {
+    uint8_t prevEp = UENUM;
+    UENUM = 0;
+
+    // Anything that aborted an earlier request has been dealt with, and a
+    // bus reset since the post will have thrown the setup packet away
+    _control_aborted = false;
+    if(UEINTX & (1 << RXSTPI)) {
+        _processSetupPacket();
+    }
+
+    // Listen for the next setup packet. If one is already waiting
+    // the ISR fires straight away and posts us again.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        UENUM = 0;
+        UEIENX |= (1 << RXSTPE);
+        UENUM = prevEp;
     }
 }
 
 static void _processIntInPacket(void) {
-    // Check to see if the NAK-IN flag is set.
-    // This means the CPU has NAK'd an IN request
-    // and we have yet to queue up new data to send.
-    if(UEINTX & (1<<NAKINI)) {
-        // Clear the NAK-IN flag to indicate
-        // we have data available on the next IN
-        // request
-        UEINTX &= ~(1<<NAKINI);
-        // Ensure the FIFO is empty
-        if(UEINTX & (1<<TXINI)) {
-            // Acknowledge the interrupt
-            UEINTX &= ~(1<<TXINI);
-            // If data has been given to us previously. Queue it up
-            if(_interrupt_in_buffer_len) {
-                // Load up the data to send
-                for(uint8_t i=0; i < _interrupt_in_buffer_len; i++) {
-                    UEDATX = _interrupt_in_buffer[i];
-                }
-                // Clear our buffer len to prevent multiple sends
-                _interrupt_in_buffer_len = 0;
-            }
-            // Free the bank
-            UEINTX &= ~(1<<FIFOCON);
+    // TXINE is enabled while a report is staged or the application is
+    // waiting for room. TXINI means a bank is free.
+    if(!(UEINTX & (1<<TXINI))) {
+        return;
+    }
+
+    if(_interrupt_in_buffer_len) {
+        // Acknowledge the interrupt
+        UEINTX &= ~(1<<TXINI);
+        // Load up the data to send
+        for(uint8_t i=0; i < _interrupt_in_buffer_len; i++) {
+            UEDATX = _interrupt_in_buffer[i];
         }
+        // Clear our buffer len to prevent multiple sends
+        _interrupt_in_buffer_len = 0;
+        // Send the bank. TXINE stays on so the worker is woken
+        // once there is room for the next report.
+        UEINTX &= ~(1<<FIFOCON);
+    }
+    else {
+        // Hand the free bank to the report worker and stop
+        // listening until it asks again
+        UEIENX &= ~(1<<TXINE);
+        work_post(WORK_USB_INT_IN);
     }
-}
\ No newline at end of file
+}
+
+static void _processBulkOutPacket(void) {
+    // Check to see if the host sent us a packet
+    if(UEINTX & (1<<RXOUTI)) {
+        uint8_t packetLen = UEBCLX;
+
+        // If the packet doesn't fit in our ring leave it in the bank.
+        // The hardware will NAK further packets until the main context
+        // has consumed enough data and re-enables this interrupt.
+        if((BULK_OUT_RING_SIZE - usb_bulkAvailable()) < packetLen) {
+            UEIENX &= ~(1<<RXOUTE);
+            return;
+        }
+
+        // Acknowledge the interrupt
+        UEINTX &= ~(1<<RXOUTI);
+        // Copy the packet into our ring
+        for(uint8_t i = 0; i < packetLen; i++) {
+            _bulk_out_ring[(_bulk_out_head + i) & (BULK_OUT_RING_SIZE - 1)] = UEDATX;
+        }
+        // Publish the bytes to the main context
+        _bulk_out_head += packetLen;
+        // Free the bank
+        UEINTX &= ~(1<<FIFOCON);
+        // and have the bulk worker deal with them
+        work_post(WORK_USB_BULK);
+    }
+}
+
+static void _processBulkInPacket(void) {
+    // TXINE is only enabled while a write is waiting for a free bank
+    if(UEINTX & (1<<TXINI)) {
+        UEIENX &= ~(1<<TXINE);
+        work_post(WORK_USB_BULK);
+    }
+}
@@ -2,11 +2,68 @@
 #define _USB_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
+// Endpoint interrupt statistics, kept by the USB_COM ISR
+typedef struct {
+    uint32_t entries;       // ISR entries
+    uint32_t events;        // Endpoint handlers run
+    uint32_t reentries;     // Entries that returned with an interrupt still pending
+    uint32_t busyMicros;    // Total time spent in the ISR
+    uint16_t maxMicros;     // Longest single ISR entry
+} usb_isr_stats_t;
+
+extern volatile usb_isr_stats_t usb_isrStats;
+
+// Enumeration statistics, reset on every bus reset
+typedef struct {
+    uint32_t resets;        // Bus resets seen since power up
+    uint32_t micros;        // Time from the last bus reset to SET_CONFIGURATION, 0 until configured
+    uint16_t requests;      // Setup requests received since the last bus reset, until configured
+    uint16_t stalls;        // How many of those were stalled
+} usb_enum_stats_t;
+
+extern volatile usb_enum_stats_t usb_enumStats;
+
+// Device states, see section 9.1 of the USB specification
+#define USB_STATE_POWERED       0
+#define USB_STATE_DEFAULT       1
+#define USB_STATE_ADDRESS       2
+#define USB_STATE_CONFIGURED    3
+
+// The control callbacks run from the WORK_USB_CONTROL worker in the main loop,
+// not the ISR. Workers are cooperative, nothing preempts a running one: reports
+// and bulk commands only go out while a callback is running if it calls
+// work_yield(). A callback that can take longer than a millisecond (one frame)
+// must call it at least that often, or the other endpoints wait until it returns.
 typedef void (*usb_controlWrite_rx_cb_t)(uint16_t rxData);
 typedef uint16_t (*usb_controlRead_tx_cb_t)(uint8_t *txData, const uint16_t requestedTxLen);
 
 void usb_init(usb_controlWrite_rx_cb_t onControlWriteCb, usb_controlRead_tx_cb_t onControlReadCb);
 uint16_t usb_sendInterruptData(const uint8_t *data, const uint16_t len);
+uint8_t usb_getState(void);
+
+// Interrupt IN: claim a report, write it byte by byte and commit it. When an
+// endpoint bank is free the bytes go straight into the FIFO, otherwise they are
+// staged and sent by the ISR once the host takes a bank. Only the most recent
+// staged report is kept. No other USB calls may be made between claim and commit.
+// If usb_reportReady() returns false, WORK_USB_INT_IN is posted once a bank frees up.
+bool usb_reportReady(void);   // True if a claim now would write straight into the FIFO
+bool usb_reportClaim(void);
+void usb_reportWrite(const uint8_t byte);
+void usb_reportCommit(void);
+
+// Bulk OUT: bytes received from the host are buffered in a ring. WORK_USB_BULK is
+// posted whenever more arrive.
+uint16_t usb_bulkAvailable(void);
+uint16_t usb_bulkPeek(uint8_t *data, const uint16_t len);
+uint16_t usb_bulkRead(uint8_t *data, const uint16_t len);
+
+// Bulk IN: writes are queued whole into the current packet or not at all. If a write
+// fails for lack of a bank, WORK_USB_BULK is posted once one frees up. Flush when
+// idle: it sends a partial packet, or the ZLP owed after a full one (posting
+// WORK_USB_BULK to try again if no bank is free).
+bool usb_bulkWrite(const uint8_t *data, const uint16_t len);
+void usb_bulkFlush(void);
 
 #endif //_USB_H_
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef _USB_DESCRIPTORS_H_
+#define _USB_DESCRIPTORS_H_
+
+/*
+ * USB descriptors (example, replace with your own). They are initialisers
+ * rather than arrays so the application (usb.c) and the firmware updater
+ * (updater.c) each keep a copy in their own section. The updater then
+ * enumerates as exactly the same device as the application. Its copy lives
+ * in the boot section, which updates don't touch, so a change here only
+ * reaches the updater when the whole chip is reprogrammed.
+ */
+
+/*! @brief Control endpoint packet size, bMaxPacketSize0 */
+#define USB_CONTROL_EP_SIZE     (8)
+
+#define USB_DEVICE_DESCRIPTOR { \
+    0x12,       /* bLength */                                                  \
+    0x01,       /* bDescriptorType (Device == 1) */                            \
+    0x01, 0x01, /* bcdUSB (USB 1.1 for Full Speed) */                          \
+    0x00,       /* bDeviceClass (0 for composite device) */                    \
+    0x00,       /* bDeviceSubClass */                                          \
+    0x00,       /* bDeviceProtocol */                                          \
+    USB_CONTROL_EP_SIZE, /* bMaxPacketSize0 */                                 \
+    0xad, 0xde, /* idVendor (0xdead) */                                        \
+    0xef, 0xbe, /* idProduct (0xbeef) */                                       \
+    0x01, 0x00, /* bcdDevice (Device version) */                               \
+    0x01,       /* iManufacturer (Index of manufacturer string descriptor) */  \
+    0x02,       /* iProduct (Index of product string descriptor) */            \
+    0x03,       /* iSerialNumber (Index of serial number string descriptor) */ \
+    0x01        /* bNumConfigurations (Number of configurations) */            \
+}
+
+#define USB_CONFIG_DESCRIPTOR { \
+    0x09,       /* bLength */                                                                     \
+    0x02,       /* bDescriptorType (Configuration == 2) */                                        \
+    0x27, 0x00, /* wTotalLength (Total length of configuration descriptor and sub-descriptors) */ \
+    0x01,       /* bNumInterfaces (Number of interfaces in this configuration) */                 \
+    0x01,       /* bConfigurationValue (Configuration value, must be 1) */                        \
+    0x00,       /* iConfiguration (Index of string descriptor for this configuration) */          \
+    0x80,       /* bmAttributes (Bus-powered, no remote wakeup) */                                \
+    0xFA,       /* bMaxPower (Maximum power consumption, 500mA) */                                \
+    0x09,       /* bLength = 0x09, length of descriptor in bytes */                               \
+    0x04,       /* bDescriptorType = 0x04, (Interface == 4) */                                    \
+    0x00,       /* bInterfaceNumber = 0; */                                                       \
+    0x00,       /* bAlternateSetting = 0; */                                                      \
+    0x03,       /* bNumEndpoints = USB_Endpoints; */                                              \
+    0xFF,       /* bInterfaceClass = 0xFF, */                                                     \
+    0xFF,       /* bInterfaceSubClass = 0xFF */                                                   \
+    0xFF,       /* bInterfaceProtocol = 0xFF */                                                   \
+    0x00,       /* iInterface = 0, Index for string descriptor interface */                       \
+    0x07,       /* bLength = 0x07, length of EP descriptor in bytes */                            \
+    0x05,       /* bDescriptorType = 0x05, (Endpoint == 5) */                                     \
+    0x81,       /* bEndpointAddress = 0x01, (IN Endpoint addr == 1) */                            \
+    0x03,       /* bmAttributes = 0x03, (Interrupt == 3) */                                       \
+    0x40, 0x00, /* wMaxPacketSize = 0x40, (64 bytes per packet) */                                \
+    0x20,       /* bInterval = 0x20, (Polling interval == 32ms for a Full-Speed interface) */     \
+    0x07,       /* bLength = 0x07, length of EP descriptor in bytes */                            \
+    0x05,       /* bDescriptorType = 0x05, (Endpoint == 5) */                                     \
+    0x02,       /* bEndpointAddress = 0x02, (OUT Endpoint addr == 2) */                           \
+    0x02,       /* bmAttributes = 0x02, (Bulk == 2) */                                            \
+    0x40, 0x00, /* wMaxPacketSize = 0x40, (64 bytes per packet) */                                \
+    0x00,       /* bInterval = 0x00, (Ignored for Bulk endpoints) */                              \
+    0x07,       /* bLength = 0x07, length of EP descriptor in bytes */                            \
+    0x05,       /* bDescriptorType = 0x05, (Endpoint == 5) */                                     \
+    0x83,       /* bEndpointAddress = 0x83, (IN Endpoint addr == 3) */                            \
+    0x02,       /* bmAttributes = 0x02, (Bulk == 2) */                                            \
+    0x40, 0x00, /* wMaxPacketSize = 0x40, (64 bytes per packet) */                                \
+    0x00        /* bInterval = 0x00, (Ignored for Bulk endpoints) */                              \
+}
+
+#define USB_LANGUAGE_DESCRIPTOR { \
+    0x04,     /* bLength - Length of sting language descriptor including this byte */ \
+    0x03,     /* bDescriptorType - (String == 3) */                                   \
+    0x09,0x04 /* wLANGID[x] - (0x0409 = English USA) */                               \
+}
+
+#define USB_MANUFACTURER_STRING_DESCRIPTOR { \
+    24,         /* bLength - Length of string descriptor (including this byte) */ \
+    0x03,       /* bDescriptorType - (String == 3) */                             \
+    'e',0x00,   /* bString - Unicode Encoded String (16 Bit) */                   \
+    'v',0x00,                                                                     \
+    'e',0x00,                                                                     \
+    'r',0x00,                                                                     \
+    'y',0x00,                                                                     \
+    'd',0x00,                                                                     \
+    'a',0x00,                                                                     \
+    'y',0x00,                                                                     \
+    'd',0x00,                                                                     \
+    'e',0x00,                                                                     \
+    'v',0x00                                                                      \
+}
+
+#define USB_PRODUCT_STRING_DESCRIPTOR { \
+    40,         /* bLength - Length of string descriptor (including this byte) */ \
+    0x03,       /* bDescriptorType - (String == 3) */                             \
+    'a',0x00,   /* bString - Unicode Encoded String (16 Bit) */                   \
+    'v',0x00,                                                                     \
+    'r',0x00,                                                                     \
+    ' ',0x00,                                                                     \
+    'u',0x00,                                                                     \
+    's',0x00,                                                                     \
+    'b',0x00,                                                                     \
+    ' ',0x00,                                                                     \
+    'm',0x00,                                                                     \
+    'a',0x00,                                                                     \
+    'd',0x00,                                                                     \
+    'e',0x00,                                                                     \
+    ' ',0x00,                                                                     \
+    's',0x00,                                                                     \
+    'i',0x00,                                                                     \
+    'm',0x00,                                                                     \
+    'p',0x00,                                                                     \
+    'l',0x00,                                                                     \
+    'e',0x00,                                                                     \
+}
+
+#define USB_SERIAL_STRING_DESCRIPTOR { \
+    0x0A,       /* bLength - Length of string descriptor (including this byte) */ \
+    0x03,       /* bDescriptorType - (String == 3) */                             \
+    '2',0x00,   /* bString - Unicode Encoded String (16 Bit) */                   \
+    '0',0x00,                                                                     \
+    '2',0x00,                                                                     \
+    '3',0x00                                                                      \
+}
+
+#endif // _USB_DESCRIPTORS_H_
@@ -0,0 +1,168 @@
+#ifndef _USB_ENDPOINTS_H_
+#define _USB_ENDPOINTS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+
+/*
+ * Compile time endpoint planner for the ATmega32u4.
+ *
+ * The endpoint table is written as an X-macro, one EP(...) line per hardware
+ * endpoint (all USB_NUM_ENDPOINTS of them, in order):
+ *
+ *   EP(num, type, dir, size, banks, interrupts, handler)
+ *
+ * From it the planner works out the DPRAM each endpoint needs, decides which
+ * EP_BANKS_AUTO endpoints can be double banked and builds the register values
+ * used to configure them. Endpoints have to be allocated in ascending order
+ * (section 22.6 of the datasheet), which is the order of the table.
+ *
+ * Double banking is handed out smallest endpoint first so that as many
+ * endpoints as possible get a second bank within USB_DPRAM_SIZE.
+ */
+
+/*! @brief Number of hardware endpoints, including the control endpoint */
+#define USB_NUM_ENDPOINTS       (7)
+/*! @brief Size in bytes of the endpoint FIFO memory */
+#define USB_DPRAM_SIZE          (832)
+
+/*! @brief Endpoint types, as written to UECFG0X */
+#define EP_TYPE_CONTROL         (0)
+#define EP_TYPE_ISOCHRONOUS     ((1 << EPTYPE0))
+#define EP_TYPE_BULK            ((1 << EPTYPE1))
+#define EP_TYPE_INTERRUPT       ((1 << EPTYPE1) | (1 << EPTYPE0))
+#define EP_TYPE_DISABLED        (0xFF)
+
+/*! @brief Endpoint directions, as written to UECFG0X */
+#define EP_DIR_OUT              (0)
+#define EP_DIR_IN               ((1 << EPDIR))
+
+/*! @brief Bank selection */
+#define EP_BANKS_SINGLE         (1)
+#define EP_BANKS_DOUBLE         (2)
+#define EP_BANKS_AUTO           (0) // Double banked if it fits in the DPRAM
+
+/*! @brief Called from the USB_COM ISR with the endpoint already selected */
+typedef void (*usb_ep_handler_t)(void);
+
+/*!
+ * @brief Register values for one endpoint, produced by the planner
+ */
+typedef struct {
+    uint8_t cfg0;               // UECFG0X, 0xFF if the endpoint is disabled
+    uint8_t cfg1;               // UECFG1X including ALLOC
+    uint8_t interrupts;         // UEIENX
+    usb_ep_handler_t handler;   // Handler for the endpoint interrupt, may be NULL
+} usb_endpoint_t;
+
+// UECFG1X EPSIZE bits for a size in bytes
+#define _EP_SIZE_BITS(size) \
+    (((size) <=   8 ? 0 : \
+      (size) <=  16 ? 1 : \
+      (size) <=  32 ? 2 : \
+      (size) <=  64 ? 3 : \
+      (size) <= 128 ? 4 : \
+      (size) <= 256 ? 5 : 6) << EPSIZE0)
+
+// Per endpoint constants. _FIXED is the DPRAM that must be allocated,
+// _AUTO is what a second bank would add if the endpoint is EP_BANKS_AUTO.
+#define _EP_ENUM(num, type, dir, size, banks, ints, cb) \
+    _EP##num##_SIZE = (size), \
+    _EP##num##_FIXED = ((type) == EP_TYPE_DISABLED ? 0 : ((size) * ((banks) == EP_BANKS_DOUBLE ? 2 : 1))), \
+    _EP##num##_AUTO = ((((type) != EP_TYPE_DISABLED) && ((banks) == EP_BANKS_AUTO)) ? (size) : 0),
+
+// DPRAM used before any EP_BANKS_AUTO endpoint is doubled
+#define _EP_DPRAM_FIXED \
+    (_EP0_FIXED + _EP1_FIXED + _EP2_FIXED + _EP3_FIXED + _EP4_FIXED + _EP5_FIXED + _EP6_FIXED)
+
+// True if endpoint k is offered a second bank no later than endpoint n
+#define _EP_BEFORE(k, n) \
+    ((_EP##k##_SIZE < _EP##n##_SIZE) || ((_EP##k##_SIZE == _EP##n##_SIZE) && ((k) <= (n))))
+
+// Second bank bytes handed out up to and including endpoint n
+#define _EP_AUTO_BEFORE(n) \
+    ((_EP0_AUTO * _EP_BEFORE(0, n)) + (_EP1_AUTO * _EP_BEFORE(1, n)) + \
+     (_EP2_AUTO * _EP_BEFORE(2, n)) + (_EP3_AUTO * _EP_BEFORE(3, n)) + \
+     (_EP4_AUTO * _EP_BEFORE(4, n)) + (_EP5_AUTO * _EP_BEFORE(5, n)) + \
+     (_EP6_AUTO * _EP_BEFORE(6, n)))
+
+// True if an EP_BANKS_AUTO endpoint ends up double banked
+#define _EP_AUTO_DOUBLED(n) \
+    ((_EP##n##_AUTO != 0) && ((_EP_DPRAM_FIXED + _EP_AUTO_BEFORE(n)) <= USB_DPRAM_SIZE))
+
+// Total DPRAM used by the plan
+#define USB_DPRAM_USED \
+    (_EP_DPRAM_FIXED + \
+     (_EP_AUTO_DOUBLED(0) ? _EP0_AUTO : 0) + (_EP_AUTO_DOUBLED(1) ? _EP1_AUTO : 0) + \
+     (_EP_AUTO_DOUBLED(2) ? _EP2_AUTO : 0) + (_EP_AUTO_DOUBLED(3) ? _EP3_AUTO : 0) + \
+     (_EP_AUTO_DOUBLED(4) ? _EP4_AUTO : 0) + (_EP_AUTO_DOUBLED(5) ? _EP5_AUTO : 0) + \
+     (_EP_AUTO_DOUBLED(6) ? _EP6_AUTO : 0))
+
+// Table entry with the planned bank count
+#define _EP_ENTRY(num, type, dir, size, banks, ints, cb) \
+    { \
+        .cfg0 = ((type) == EP_TYPE_DISABLED ? 0xFF : ((type) | (dir))), \
+        .cfg1 = _EP_SIZE_BITS(size) | \
+                ((((banks) == EP_BANKS_DOUBLE) || _EP_AUTO_DOUBLED(num)) ? (1 << EPBK0) : 0) | \
+                (1 << ALLOC), \
+        .interrupts = (ints), \
+        .handler = (cb), \
+    },
+
+// Compile time checks of one table line
+#define _EP_CHECK(num, type, dir, size, banks, ints, cb) \
+    _Static_assert(((type) == EP_TYPE_DISABLED) || \
+                   (((size) >= 8) && (((size) & ((size) - 1)) == 0)), \
+                   "EP" #num ": size must be a power of 2 of at least 8 bytes"); \
+    _Static_assert(((type) == EP_TYPE_DISABLED) || ((size) <= ((num) == 1 ? 256 : 64)), \
+                   "EP" #num ": size is larger than the hardware supports"); \
+    _Static_assert(((num) == 0) == ((type) == EP_TYPE_CONTROL), \
+                   "EP" #num ": only endpoint 0 can be, and must be, a control endpoint"); \
+    _Static_assert(((num) != 0) || ((banks) == EP_BANKS_SINGLE), \
+                   "EP0: the control endpoint must be single banked");
+
+// Bit for an endpoint that has a handler
+#define _EP_HANDLED(num, type, dir, size, banks, ints, cb) \
+    | (((usb_ep_handler_t)(cb) != (usb_ep_handler_t)NULL) ? (1 << (num)) : 0)
+
+// Select an endpoint and call its handler if its bit is pending. The handler is
+// a compile time constant so the compiler drops the whole block for endpoints
+// without one and calls the rest directly.
+#define _EP_DISPATCH(num, type, dir, size, banks, ints, cb) \
+    if(((usb_ep_handler_t)(cb) != (usb_ep_handler_t)NULL) && (_ep_pending & (1 << (num)))) { \
+        UENUM = (num); \
+        ((usb_ep_handler_t)(cb))(); \
+        _ep_events++; \
+    }
+
+/*! @brief Mask of the endpoints in a table that have a handler */
+#define USB_ENDPOINT_HANDLED(table) \
+    ((uint8_t)(0 table(_EP_HANDLED)))
+
+/*!
+ * @brief Expands to code that services every endpoint whose bit is set in
+ * pending, lowest endpoint first, adding the number of handlers run to events.
+ */
+#define USB_ENDPOINT_DISPATCH(table, pending, events) \
+    do { \
+        uint8_t _ep_pending = (pending); \
+        uint8_t _ep_events = 0; \
+        table(_EP_DISPATCH) \
+        (events) += _ep_events; \
+    } while(0)
+
+/*!
+ * @brief Expands an endpoint table into a const usb_endpoint_t array
+ * called name, checking it against the hardware at compile time.
+ */
+#define USB_ENDPOINT_PLAN(name, table) \
+    enum { table(_EP_ENUM) }; \
+    table(_EP_CHECK) \
+    _Static_assert(_EP_DPRAM_FIXED <= USB_DPRAM_SIZE, \
+                   "Endpoint table does not fit in the DPRAM"); \
+    _Static_assert(USB_DPRAM_USED <= USB_DPRAM_SIZE, \
+                   "Endpoint plan does not fit in the DPRAM"); \
+    static const usb_endpoint_t PROGMEM name[USB_NUM_ENDPOINTS] = { table(_EP_ENTRY) }
+
+#endif // _USB_ENDPOINTS_H_
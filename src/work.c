@@ -0,0 +1,125 @@
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "work.h"
+#include "tick.h"
+
+/*! @brief _current value while no worker is running */
+#define WORK_NONE               (0xFF)
+
+_Static_assert(WORK_NUM_IDS <= 8, "Work ids must fit in the pending mask");
+
+volatile work_stats_t work_stats[WORK_NUM_IDS] = {{0}};
+
+static work_fn_t _workers[WORK_NUM_IDS] = {NULL};
+/*! @brief Bit n is set while work n is pending */
+static volatile uint8_t _pending = 0;
+/*! @brief When each pending work was posted */
+static uint32_t _posted_micros[WORK_NUM_IDS] = {0};
+/*! @brief Worker running at the moment, WORK_NONE if there isn't one */
+static volatile uint8_t _current = WORK_NONE;
+
+static uint8_t _highestPending(const uint8_t limit);
+static void _run(const uint8_t id);
+
+/*!
+ * @brief This API sets the function run for a work id
+ */
+void work_register(const uint8_t id, work_fn_t fn) {
+    if(id < WORK_NUM_IDS) {
+        _workers[id] = fn;
+    }
+}
+
+/*!
+ * @brief This API marks work as pending
+ */
+void work_post(const uint8_t id) {
+    if(id >= WORK_NUM_IDS) {
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Latency is measured from the first post
+        if(!(_pending & (1 << id))) {
+            _pending |= (1 << id);
+            _posted_micros[id] = tick_getMicros();
+        }
+    }
+}
+
+/*!
+ * @brief This API runs every pending worker, highest priority first
+ */
+void work_run(void) {
+    uint8_t id;
+
+    cli();
+    // Look again after every worker, it may have posted more work
+    // or an ISR may have posted something more important
+    while((id = _highestPending(WORK_NUM_IDS)) != WORK_NONE) {
+        _run(id);
+    }
+    sei();
+}
+
+/*!
+ * @brief This API runs higher priority work from inside the running worker
+ */
+void work_yield(void) {
+    uint8_t id;
+
+    cli();
+    // Only more important work than the caller's, so the
+    // caller is never run again before it returns
+    if(_current != WORK_NONE) {
+        while((id = _highestPending(_current)) != WORK_NONE) {
+            _run(id);
+        }
+    }
+    sei();
+}
+
+/*!
+ * @brief Returns the highest priority pending id below limit, or WORK_NONE
+ */
+static uint8_t _highestPending(const uint8_t limit) {
+    for(uint8_t id = 0; id < limit; id++) {
+        if(_pending & (1 << id)) {
+            return id;
+        }
+    }
+
+    return WORK_NONE;
+}
+
+/*!
+ * @brief Runs one worker with interrupts enabled. Must be called, and
+ * returns, with interrupts disabled.
+ */
+static void _run(const uint8_t id) {
+    uint8_t yielded = _current;
+    uint32_t start = tick_getMicros();
+    uint32_t latency = start - _posted_micros[id];
+
+    _pending &= ~(1 << id);
+    _current = id;
+
+    sei();
+    if(_workers[id] != NULL) {
+        _workers[id]();
+    }
+    cli();
+
+    uint32_t elapsed = tick_getMicros() - start;
+    _current = yielded;
+
+    work_stats[id].runs++;
+    if(latency > work_stats[id].maxLatencyMicros) {
+        work_stats[id].maxLatencyMicros = (latency > UINT16_MAX) ? UINT16_MAX : latency;
+    }
+    if(elapsed > work_stats[id].maxRunMicros) {
+        work_stats[id].maxRunMicros = (elapsed > UINT16_MAX) ? UINT16_MAX : elapsed;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef _WORK_H_
+#define _WORK_H_
+
+#include <stdint.h>
+
+/*
+ * Deferred work. ISRs only do the hardware bookkeeping and post whatever
+ * else needs doing to a worker. Workers run to completion from the main
+ * loop, highest priority (lowest id) first.
+ *
+ * Workers are never run from an ISR. A worker that takes a long time (a
+ * slow control request, or one waiting on the host) calls work_yield() at
+ * points where it is safe to do so, and any more important work that was
+ * posted in the meantime runs there, on the main stack. Nothing preempts
+ * a worker, one that doesn't yield holds up everything else until it
+ * returns. A worker only ever yields to higher priority ones, so no
+ * worker is ever re-entered and at most WORK_NUM_IDS of them are nested
+ * on the stack.
+ */
+
+/*! @brief Work ids, highest priority first */
+#define WORK_USB_INT_IN         (0) // The interrupt IN endpoint has room for a report
+#define WORK_USB_BULK           (1) // Bulk OUT data arrived or a bulk IN bank freed up
+#define WORK_USB_CONTROL        (2) // A setup packet is waiting on the control endpoint
+#define WORK_NUM_IDS            (3)
+
+typedef void (*work_fn_t)(void);
+
+/*!
+ * @brief Timing of one worker
+ */
+typedef struct {
+    uint32_t runs;              // Times the worker has run
+    uint16_t maxLatencyMicros;  // Longest wait from being posted to running
+    uint16_t maxRunMicros;      // Longest run, including any time it spent yielding
+} work_stats_t;
+
+extern volatile work_stats_t work_stats[WORK_NUM_IDS];
+
+/*!
+ * @brief This API sets the function run for a work id
+ *
+ * @param[in] id : WORK_* id
+ * @param[in] fn : Function to run when the work is posted
+ *
+ * @returns Returns void
+ */
+void work_register(const uint8_t id, work_fn_t fn);
+
+/*!
+ * @brief This API marks work as pending. Posting work that is already
+ * pending does nothing, it still runs once. Safe to call from an ISR.
+ *
+ * @param[in] id : WORK_* id
+ *
+ * @returns Returns void
+ */
+void work_post(const uint8_t id);
+
+/*!
+ * @brief This API runs every pending worker, highest priority first,
+ * until nothing is pending. Call it from the main loop.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void work_run(void);
+
+/*!
+ * @brief This API runs any pending work that has a higher priority than the
+ * worker calling it, then returns to it. Call it from a worker, with
+ * interrupts enabled, wherever that worker can safely be paused. Outside
+ * of a worker it does nothing, the main loop gets to the work anyway.
+ *
+ * @param[in] void
+ *
+ * @returns Returns void
+ */
+void work_yield(void);
+
+#endif // _WORK_H_
@@ -0,0 +1,16 @@
+#ifndef _TEST_PGMSPACE_H_
+#define _TEST_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Host stand-in for avr-libc's pgmspace.h. Unit tests run on the host
+ * where flash and RAM share one address space.
+ */
+#define PROGMEM
+#define memcpy_P(dest, src, len)    memcpy((dest), (src), (len))
+#define pgm_read_byte(addr)         (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)         (*(const uint16_t *)(addr))
+
+#endif // _TEST_PGMSPACE_H_
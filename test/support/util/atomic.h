@@ -0,0 +1,12 @@
+#ifndef _TEST_ATOMIC_H_
+#define _TEST_ATOMIC_H_
+
+/*
+ * Host stand-in for avr-libc's atomic.h. Unit tests have no interrupts,
+ * so an atomic block just runs its body once.
+ */
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for(int _atomic_once = 1; _atomic_once; _atomic_once = 0)
+
+#endif // _TEST_ATOMIC_H_
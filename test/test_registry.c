@@ -0,0 +1,123 @@
+#ifdef TEST
+
+#include <string.h>
+#include "unity.h"
+#include "registry.h"
+
+static uint8_t var8;
+static uint16_t var16;
+static uint32_t var32;
+static uint16_t readOnly;
+
+static const registry_entry_t table[] = {
+    REGISTRY_ENTRY(0, var16, REGISTRY_READ | REGISTRY_WRITE),
+    REGISTRY_ENTRY(1, readOnly, REGISTRY_READ),
+    REGISTRY_ENTRY(5, var8, REGISTRY_READ | REGISTRY_WRITE),
+    REGISTRY_ENTRY(31, var32, REGISTRY_READ | REGISTRY_WRITE),
+};
+
+static uint32_t writeMask;
+static int writeCalls;
+
+static void onWrite(const uint32_t mask) {
+    writeMask = mask;
+    writeCalls++;
+}
+
+void setUp(void)
+{
+    var8 = 0x11;
+    var16 = 0x2233;
+    var32 = 0x44556677;
+    readOnly = 0x8899;
+    writeMask = 0;
+    writeCalls = 0;
+    registry_init(table, sizeof(table) / sizeof(table[0]));
+    registry_setWriteCallback(onWrite);
+}
+
+void tearDown(void)
+{
+}
+
+void test_registry_describe_lists_every_entry(void)
+{
+    uint8_t buff[32];
+    const uint8_t expected[] = {
+        0, 2, REGISTRY_READ | REGISTRY_WRITE,
+        1, 2, REGISTRY_READ,
+        5, 1, REGISTRY_READ | REGISTRY_WRITE,
+        31, 4, REGISTRY_READ | REGISTRY_WRITE,
+    };
+
+    TEST_ASSERT_EQUAL_UINT16(sizeof(expected), registry_describe(buff, sizeof(buff)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, buff, sizeof(expected));
+}
+
+void test_registry_describe_only_writes_whole_entries(void)
+{
+    uint8_t buff[8];
+
+    TEST_ASSERT_EQUAL_UINT16(2 * REGISTRY_DESC_SIZE, registry_describe(buff, sizeof(buff)));
+}
+
+void test_registry_read_packs_in_ascending_id_order(void)
+{
+    uint8_t buff[16];
+    const uint8_t expected[] = {0x33, 0x22, 0x11, 0x77, 0x66, 0x55, 0x44};
+
+    TEST_ASSERT_EQUAL_UINT16(sizeof(expected),
+        registry_read((1UL << 31) | (1 << 5) | (1 << 0), buff, sizeof(buff)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, buff, sizeof(expected));
+}
+
+void test_registry_read_rejects_unknown_ids(void)
+{
+    uint8_t buff[16];
+
+    TEST_ASSERT_EQUAL_UINT16(0, registry_read((1 << 0) | (1 << 2), buff, sizeof(buff)));
+    TEST_ASSERT_EQUAL_UINT16(0, registry_read(0, buff, sizeof(buff)));
+}
+
+void test_registry_read_rejects_batches_that_dont_fit(void)
+{
+    uint8_t buff[16];
+
+    // 2 + 2 + 1 + 4 bytes
+    TEST_ASSERT_EQUAL_UINT16(0, registry_read(0x80000023, buff, 8));
+    TEST_ASSERT_EQUAL_UINT16(9, registry_read(0x80000023, buff, 9));
+}
+
+void test_registry_write_unpacks_and_calls_back(void)
+{
+    const uint8_t data[] = {0xAA, 0xBB, 0xCC};
+
+    TEST_ASSERT_TRUE(registry_write((1 << 0) | (1 << 5), data, sizeof(data)));
+    TEST_ASSERT_EQUAL_HEX16(0xBBAA, var16);
+    TEST_ASSERT_EQUAL_HEX8(0xCC, var8);
+    TEST_ASSERT_EQUAL_INT(1, writeCalls);
+    TEST_ASSERT_EQUAL_HEX32((1 << 0) | (1 << 5), writeMask);
+}
+
+void test_registry_write_is_all_or_nothing(void)
+{
+    const uint8_t data[] = {0xAA, 0xBB, 0xCC, 0xDD};
+
+    // Id 1 is read only, so id 0 must not change either
+    TEST_ASSERT_FALSE(registry_write((1 << 0) | (1 << 1), data, sizeof(data)));
+    TEST_ASSERT_EQUAL_HEX16(0x2233, var16);
+    TEST_ASSERT_EQUAL_HEX16(0x8899, readOnly);
+    TEST_ASSERT_EQUAL_INT(0, writeCalls);
+}
+
+void test_registry_write_rejects_a_wrong_length(void)
+{
+    const uint8_t data[] = {0xAA, 0xBB, 0xCC};
+
+    TEST_ASSERT_FALSE(registry_write(1 << 0, data, 1));
+    TEST_ASSERT_FALSE(registry_write(1 << 0, data, 3));
+    TEST_ASSERT_EQUAL_HEX16(0x2233, var16);
+    TEST_ASSERT_EQUAL_INT(0, writeCalls);
+}
+
+#endif // TEST
@@ -0,0 +1,274 @@
+#ifdef TEST
+
+#include <string.h>
+#include "unity.h"
+#include "report.h"
+#include "protocol.h"
+#include "mock_usb.h"
+#include "mock_tick.h"
+#include "mock_work.h"
+
+#define MAX_REPORTS 16
+
+static uint32_t now;
+static bool ready;
+static uint8_t building[PROTOCOL_REPORT_SIZE + 1];
+static int buildingLen;
+static uint8_t reports[MAX_REPORTS][PROTOCOL_REPORT_SIZE];
+static int reportLens[MAX_REPORTS];
+static int numReports;
+static int posts;
+
+static uint32_t fakeMicros(int cmock_num_calls) {
+    return now;
+}
+
+static bool fakeReady(int cmock_num_calls) {
+    return ready;
+}
+
+static void captureWrite(const uint8_t byte, int cmock_num_calls) {
+    TEST_ASSERT_TRUE(buildingLen < PROTOCOL_REPORT_SIZE);
+    building[buildingLen++] = byte;
+}
+
+static void captureCommit(int cmock_num_calls) {
+    TEST_ASSERT_TRUE(numReports < MAX_REPORTS);
+    memcpy(reports[numReports], building, buildingLen);
+    reportLens[numReports++] = buildingLen;
+    buildingLen = 0;
+}
+
+static void countPost(const uint8_t id, int cmock_num_calls) {
+    TEST_ASSERT_EQUAL_UINT8(WORK_USB_INT_IN, id);
+    posts++;
+}
+
+// Decodes a report the same way the host tools do (decode_report() in
+// host/python/usb_async.py) and returns the sample count
+static int decode(const int report, uint32_t *times, uint8_t *states) {
+    const uint8_t *r = reports[report];
+    uint32_t time = r[4] | (r[5] << 8) | (r[6] << 16) | ((uint32_t)r[7] << 24);
+
+    TEST_ASSERT_EQUAL_UINT8(PROTOCOL_VERSION, r[0]);
+    TEST_ASSERT_EQUAL_INT(PROTOCOL_HEADER_SIZE + (r[1] * PROTOCOL_SAMPLE_SIZE), reportLens[report]);
+
+    for(int i = 0; i < r[1]; i++) {
+        uint16_t sample = r[PROTOCOL_HEADER_SIZE + (i * 2)] | (r[PROTOCOL_HEADER_SIZE + (i * 2) + 1] << 8);
+        time += PROTOCOL_SAMPLE_DELTA(sample) * PROTOCOL_SAMPLE_DELTA_US;
+        times[i] = time;
+        states[i] = PROTOCOL_SAMPLE_STATE(sample);
+    }
+
+    return r[1];
+}
+
+void setUp(void)
+{
+    tick_getMicros_StubWithCallback(fakeMicros);
+    usb_reportReady_StubWithCallback(fakeReady);
+    usb_reportClaim_IgnoreAndReturn(true);
+    usb_reportWrite_StubWithCallback(captureWrite);
+    usb_reportCommit_StubWithCallback(captureCommit);
+    work_post_StubWithCallback(countPost);
+
+    // The module keeps its queue between tests, send anything left over
+    ready = true;
+    buildingLen = 0;
+    numReports = 0;
+    for(int i = 0; i < MAX_REPORTS; i++) {
+        report_task();
+    }
+
+    now = 1000;
+    buildingLen = 0;
+    numReports = 0;
+    posts = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_report_single_sample(void)
+{
+    const uint8_t expected[] = {PROTOCOL_VERSION, 1, 0, 0, 0xE8, 0x03, 0x00, 0x00, 0x05, 0x00};
+
+    report_sample(0x05);
+    TEST_ASSERT_EQUAL_INT(1, posts);
+
+    report_task();
+    TEST_ASSERT_EQUAL_INT(1, numReports);
+    TEST_ASSERT_EQUAL_INT(sizeof(expected), reportLens[0]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, reports[0], sizeof(expected));
+}
+
+void test_report_state_is_masked(void)
+{
+    uint32_t times[PROTOCOL_MAX_SAMPLES];
+    uint8_t states[PROTOCOL_MAX_SAMPLES];
+
+    report_sample(0xFF);
+    report_task();
+
+    TEST_ASSERT_EQUAL_INT(1, decode(0, times, states));
+    TEST_ASSERT_EQUAL_UINT8(PROTOCOL_SAMPLE_STATE_MASK, states[0]);
+}
+
+void test_report_fills_exactly_one_bank_then_continues(void)
+{
+    uint32_t times[PROTOCOL_MAX_SAMPLES];
+    uint8_t states[PROTOCOL_MAX_SAMPLES];
+
+    // One more sample than a report can carry
+    for(int i = 0; i <= PROTOCOL_MAX_SAMPLES; i++) {
+        report_sample(i & PROTOCOL_SAMPLE_STATE_MASK);
+        now += PROTOCOL_SAMPLE_DELTA_US;
+    }
+
+    posts = 0;
+    report_task();
+    TEST_ASSERT_EQUAL_INT(1, numReports);
+    TEST_ASSERT_EQUAL_INT(PROTOCOL_REPORT_SIZE, reportLens[0]);
+    TEST_ASSERT_EQUAL_INT(PROTOCOL_MAX_SAMPLES, decode(0, times, states));
+    for(int i = 0; i < PROTOCOL_MAX_SAMPLES; i++) {
+        TEST_ASSERT_EQUAL_UINT32(1000 + (i * PROTOCOL_SAMPLE_DELTA_US), times[i]);
+        TEST_ASSERT_EQUAL_UINT8(i & PROTOCOL_SAMPLE_STATE_MASK, states[i]);
+    }
+    // The leftover sample brings the worker back
+    TEST_ASSERT_EQUAL_INT(1, posts);
+
+    report_task();
+    TEST_ASSERT_EQUAL_INT(2, numReports);
+    TEST_ASSERT_EQUAL_INT(1, decode(1, times, states));
+    TEST_ASSERT_EQUAL_UINT32(1000 + (PROTOCOL_MAX_SAMPLES * PROTOCOL_SAMPLE_DELTA_US), times[0]);
+    TEST_ASSERT_EQUAL_UINT8(PROTOCOL_MAX_SAMPLES & PROTOCOL_SAMPLE_STATE_MASK, states[0]);
+    TEST_ASSERT_EQUAL_INT(1, posts);
+}
+
+void test_report_delta_rounding_does_not_accumulate(void)
+{
+    uint32_t times[PROTOCOL_MAX_SAMPLES];
+    uint8_t states[PROTOCOL_MAX_SAMPLES];
+
+    // 12us apart, which isn't a whole number of delta units
+    for(int i = 0; i < 8; i++) {
+        report_sample(i);
+        now += 12;
+    }
+    report_task();
+
+    TEST_ASSERT_EQUAL_INT(8, decode(0, times, states));
+    for(int i = 0; i < 8; i++) {
+        uint32_t actual = 1000 + (i * 12);
+        TEST_ASSERT_TRUE(times[i] <= actual);
+        TEST_ASSERT_TRUE((actual - times[i]) < PROTOCOL_SAMPLE_DELTA_US);
+    }
+}
+
+void test_report_long_gap_starts_a_new_report(void)
+{
+    uint32_t times[PROTOCOL_MAX_SAMPLES];
+    uint8_t states[PROTOCOL_MAX_SAMPLES];
+
+    report_sample(1);
+    now += (PROTOCOL_SAMPLE_DELTA_MAX + 1) * PROTOCOL_SAMPLE_DELTA_US;
+    report_sample(2);
+
+    report_task();
+    report_task();
+
+    TEST_ASSERT_EQUAL_INT(2, numReports);
+    TEST_ASSERT_EQUAL_INT(1, decode(0, times, states));
+    TEST_ASSERT_EQUAL_UINT32(1000, times[0]);
+    TEST_ASSERT_EQUAL_INT(1, decode(1, times, states));
+    TEST_ASSERT_EQUAL_UINT32(now, times[0]);
+    TEST_ASSERT_EQUAL_UINT8(2, states[0]);
+}
+
+void test_report_waits_for_a_free_bank(void)
+{
+    ready = false;
+    report_sample(1);
+    report_task();
+    TEST_ASSERT_EQUAL_INT(0, numReports);
+
+    ready = true;
+    report_task();
+    TEST_ASSERT_EQUAL_INT(1, numReports);
+}
+
+void test_report_counts_drops_once(void)
+{
+    ready = false;
+    for(int i = 0; i < REPORT_QUEUE_SIZE + 3; i++) {
+        report_sample(i);
+        now += PROTOCOL_SAMPLE_DELTA_US;
+    }
+
+    ready = true;
+    report_task();
+    report_task();
+
+    TEST_ASSERT_EQUAL_INT(2, numReports);
+    TEST_ASSERT_EQUAL_UINT8(PROTOCOL_MAX_SAMPLES, reports[0][1]);
+    TEST_ASSERT_EQUAL_UINT8(3, reports[0][2]);
+    TEST_ASSERT_EQUAL_UINT8(REPORT_QUEUE_SIZE - PROTOCOL_MAX_SAMPLES, reports[1][1]);
+    TEST_ASSERT_EQUAL_UINT8(0, reports[1][2]);
+}
+
+void test_report_drop_count_saturates(void)
+{
+    ready = false;
+    for(int i = 0; i < REPORT_QUEUE_SIZE + 300; i++) {
+        report_sample(i);
+    }
+
+    ready = true;
+    report_task();
+
+    TEST_ASSERT_EQUAL_UINT8(UINT8_MAX, reports[0][2]);
+}
+
+void test_report_queue_indexes_wrap(void)
+{
+    uint32_t times[PROTOCOL_MAX_SAMPLES];
+    uint8_t states[PROTOCOL_MAX_SAMPLES];
+    int sent = 0;
+
+    // Enough samples to take the free running head and tail past 255 a few
+    // times, a batch at a time so the queue is never empty when it wraps
+    for(int batch = 0; batch < 40; batch++) {
+        numReports = 0;
+        for(int i = 0; i < 20; i++) {
+            report_sample((sent + i) & PROTOCOL_SAMPLE_STATE_MASK);
+            now += PROTOCOL_SAMPLE_DELTA_US;
+        }
+        report_task();
+
+        TEST_ASSERT_EQUAL_INT(1, numReports);
+        TEST_ASSERT_EQUAL_INT(20, decode(0, times, states));
+        for(int i = 0; i < 20; i++) {
+            TEST_ASSERT_EQUAL_UINT8((sent + i) & PROTOCOL_SAMPLE_STATE_MASK, states[i]);
+        }
+        sent += 20;
+    }
+}
+
+void test_report_time_wraps(void)
+{
+    uint32_t times[PROTOCOL_MAX_SAMPLES];
+    uint8_t states[PROTOCOL_MAX_SAMPLES];
+
+    now = 0xFFFFFFF0;
+    report_sample(1);
+    now += 32;
+    report_sample(2);
+    report_task();
+
+    TEST_ASSERT_EQUAL_INT(2, decode(0, times, states));
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFF0, times[0]);
+    TEST_ASSERT_EQUAL_UINT32(0x00000010, times[1]);
+}
+
+#endif // TEST